@@ -1,40 +1,40 @@
 #pragma once
 
 #include <SFML/Network/IpAddress.hpp>
-#include <SFML/Network/Packet.hpp>
-#include <SFML/Network/Socket.hpp>
-#include <SFML/Network/UdpSocket.hpp>
-#include <SFML/Window/WindowEnums.hpp>
-#include <cstdlib>
+#include <optional>
 #include <span>
-#include <type_traits>
 #include <vector>
 
-#include <SFML/Network.hpp>
-
 #include "easylogging++.h"
-INITIALIZE_EASYLOGGINGPP
 
+#include "datagram.h"
+#include "wire.h"
 #include "world.h"
 
-using byte = uint8_t;
-using bytes = std::vector<byte>;
-using byte_span = std::span<byte>;
-
-template <typename T> byte_span Serialise(T &&t) {
-  static_assert(std::is_standard_layout_v<std::remove_reference_t<T>>);
-  return {reinterpret_cast<byte *>(&t), sizeof(T)};
-}
-
-template <typename T> T Deserialise(const bytes &data) {
-  static_assert(std::is_standard_layout_v<std::remove_reference_t<T>>);
-  return *(reinterpret_cast<T *>(data.data()));
-}
+// The balls protocol: one message per UDP datagram, after the packet header
+// in channel.h, a MessageID byte and then the message's payload. The payloads
+// are the structs below, laid out as their Wire<T> says (see wire.h). Those
+// marked * go on the reliable channel and arrive once, in order; the rest may
+// not arrive at all.
+//
+//   client                              server
+//   StartSession {Version} *     ->
+//                                <-     StartSession {SessionInfo} *, or
+//                                         Error *
+//   Ok (every second or so)      ->     (keeps the session alive)
+//   Camera {Camera}              ->     (when it moves, and as the keep alive)
+//                                <-     World {snapshot, see snapshot.h}
+//                                <-     Fragment {part of a bigger message,
+//                                         see fragment.h}
+//   Ack {Ack}                    ->
+//   EntityID {Pick} *            ->
+//                                <-     EntityID {Picked} *
+//   UpdatePosition {Move}        ->
+//   Version *                    ->
+//                                <-     Version {Version} *
+//   QuitSession *                ->
 
-template <typename T> T Deserialise(std::span<byte> data) {
-  static_assert(std::is_standard_layout_v<std::remove_reference_t<T>>);
-  return *(reinterpret_cast<T *>(data.data()));
-}
+using bytes = std::vector<byte>;
 
 enum class MessageID : uint8_t {
   Ok = 0,
@@ -44,7 +44,10 @@ enum class MessageID : uint8_t {
   EntityID,
   UpdatePosition,
   World,
-  QuitSession
+  QuitSession,
+  Ack,
+  Camera,
+  Fragment
 };
 
 struct Version {
@@ -53,57 +56,108 @@ struct Version {
   uint8_t build;
 };
 
-struct Connection {
-  Connection(sf::IpAddress address, uint32_t port)
-      : socket(), address(address), port(port) {
-    if (socket.bind(sf::Socket::AnyPort) == sf::Socket::Status::Error) {
-      LOG(ERROR) << "Failure to bind UDP port. Exiting...";
-      exit(-1);
-    }
-  }
+// Sessions are only started for the same major and minor version.
+inline constexpr Version VERSION = {0, 6, 0};
 
-  sf::UdpSocket socket;
-  sf::IpAddress address;
-  uint32_t port;
+inline constexpr unsigned short DEFAULT_PORT = 50000;
+
+// Kept under the smallest common MTU once IP, UDP and packet headers are
+// added, so datagrams are never fragmented on the way.
+inline constexpr std::size_t MAX_PAYLOAD = 1200;
 
-  // Messages are the format
-  // ID
-  template <typename T> bool Send(MessageID id, T &&data) {
-    sf::Packet p;
-    p << static_cast<uint8_t>(id);
+struct SessionInfo {
+  uint32_t session;
+  uint32_t tick_rate; // simulation steps per second
+  uint32_t send_rate; // World snapshots per second
+  // steps per unit the World snapshots are quantized to
+  uint16_t position_steps;
+  uint16_t velocity_steps;
+};
+
+// The World snapshots received up to `sequence`, with bit k set if
+// sequence - 1 - k was received too.
+struct Ack {
+  uint32_t sequence;
+  uint32_t received;
+};
+
+// A body as the client sees it.
+struct BodyState {
+  int32_t id;
+  float x, y; // centre
+  float vx, vy;
+  float radius;
+  uint32_t color; // RGBA
+};
+
+// The part of the world a client is looking at. Only the bodies in or near
+// it are sent; a client that never says gets them all.
+struct Camera {
+  float x, y; // top left
+  float width, height;
+
+  bool operator==(const Camera &) const = default;
+};
+
+// Which entity is at a point in the world?
+struct Pick {
+  float x, y;
+};
 
-    auto span = Serialise(data);
-    p.append(span.data(), span.size());
-    return socket.send(p, address, port) == sf::Socket::Status::Done;
-  }
+struct Picked {
+  int32_t id; // -1 for none
 };
 
-template <typename T> std::optional<T> Receive(sf::UdpSocket &s) {
-  sf::Packet p;
-  std::optional<sf::IpAddress> ip;
+// Puts an entity's centre at a point and stops it.
+struct Move {
+  int32_t id;
+  float x, y;
+};
+
+template <> struct Wire<Version> {
+  static constexpr auto fields =
+      std::tuple{&Version::major, &Version::minor, &Version::build};
+};
+
+template <> struct Wire<SessionInfo> {
+  static constexpr auto fields = std::tuple{
+      &SessionInfo::session, &SessionInfo::tick_rate, &SessionInfo::send_rate,
+      &SessionInfo::position_steps, &SessionInfo::velocity_steps
+  };
+};
+
+template <> struct Wire<Ack> {
+  static constexpr auto fields = std::tuple{&Ack::sequence, &Ack::received};
+};
+
+template <> struct Wire<Camera> {
+  static constexpr auto fields =
+      std::tuple{&Camera::x, &Camera::y, &Camera::width, &Camera::height};
+};
+
+template <> struct Wire<Pick> {
+  static constexpr auto fields = std::tuple{&Pick::x, &Pick::y};
+};
+
+template <> struct Wire<Picked> {
+  static constexpr auto fields = std::tuple{&Picked::id};
+};
+
+template <> struct Wire<Move> {
+  static constexpr auto fields = std::tuple{&Move::id, &Move::x, &Move::y};
+};
+
+// The payload is a view into the socket's buffers, good until the socket
+// receives its next batch.
+struct Message {
+  MessageID id;
+  std::span<const byte> payload;
+  sf::IpAddress address;
   unsigned short port;
-  if (s.receive(p, ip, port) != sf::Socket::Status::Done) {
-    return std::nullopt;
-  }
-
-  uint8_t id;
-  p >> id;
-
-  switch (static_cast<MessageID>(id)) {
-  case MessageID::Version:
-    ParseMessage<T>(p);
-  case MessageID::Ok:
-  case MessageID::Error:
-  case MessageID::StartSession:
-  case MessageID::EntityID:
-  case MessageID::UpdatePosition:
-  case MessageID::World:
-  case MessageID::QuitSession:
-    break;
-  }
-  return;
-}
+};
 
-template <typename T> std::optional<T> ParseMessage(sf::UdpSocket &) {
-  return std::nullopt;
+// The message's payload read as a T, in place, if it's long enough to hold
+// one.
+template <typename T> std::optional<View<T>> ParseMessage(const Message &m) {
+  return View<T>::of(m.payload);
 }
@@ -0,0 +1,293 @@
+#pragma once
+
+// Logging for hot paths. A call copies the format string pointer and the
+// arguments into a small fixed-size record in the calling thread's ring,
+// without locks, formatting or system calls. A background thread drains the
+// rings every few milliseconds, formats the records in time order and hands
+// them to easylogging++ in one batch.
+//
+//   ALOG(WARNING, "Energy drifted by {}% at frame {}", drift, frame);
+//
+// Each {} takes the next argument. Arguments are numbers, bools or string
+// literals; the format and any strings must outlive the record, since only
+// the pointers are stored. When a thread's ring is full its records are
+// dropped and counted rather than waiting for the logger.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <easylogging++.h>
+
+namespace asynclog {
+
+enum class Level : uint8_t
+{
+  INFO,
+  WARNING,
+  ERROR,
+};
+
+struct Arg {
+  enum Type : uint8_t
+  {
+    Int,
+    Uint,
+    Double,
+    Bool,
+    String,
+  };
+
+  Type type;
+  union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    bool b;
+    const char *s;
+  };
+};
+
+inline Arg make_arg(bool b) {
+  Arg a;
+  a.type = Arg::Bool;
+  a.b = b;
+  return a;
+}
+
+inline Arg make_arg(const char *s) {
+  Arg a;
+  a.type = Arg::String;
+  a.s = s;
+  return a;
+}
+
+template <typename T>
+  requires std::is_arithmetic_v<T>
+Arg make_arg(T value) {
+  Arg a;
+  if constexpr (std::is_floating_point_v<T>) {
+    a.type = Arg::Double;
+    a.d = value;
+  } else if constexpr (std::is_signed_v<T>) {
+    a.type = Arg::Int;
+    a.i = value;
+  } else {
+    a.type = Arg::Uint;
+    a.u = value;
+  }
+  return a;
+}
+
+struct Record {
+  static constexpr std::size_t MAX_ARGS = 6;
+
+  int64_t time; // steady clock, ns
+  const char *format;
+  Level level;
+  uint8_t count;
+  std::array<Arg, MAX_ARGS> args;
+};
+
+// One thread's records. The owner pushes and the logger thread pops, so head
+// and tail are the only shared state.
+struct Ring {
+  static constexpr std::size_t CAPACITY = 1024;
+
+  std::array<Record, CAPACITY> records;
+  std::atomic<uint64_t> head = 0; // records ever pushed
+  std::atomic<uint64_t> tail = 0; // records ever popped
+  std::atomic<uint64_t> dropped = 0;
+  uint64_t reported = 0; // drops already logged, logger thread only
+
+  bool push(const Record &r) {
+    const uint64_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == CAPACITY) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    records[h % CAPACITY] = r;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+};
+
+class Logger {
+public:
+  // how long records may wait before they are written
+  static constexpr std::chrono::milliseconds PERIOD{5};
+
+  static Logger &get() {
+    static Logger logger;
+    return logger;
+  }
+
+  Ring &ring() {
+    thread_local Ring *mine = nullptr;
+    if (!mine) {
+      std::lock_guard lock(m_rings_mutex);
+      m_rings.push_back(std::make_unique<Ring>());
+      mine = m_rings.back().get();
+    }
+    return *mine;
+  }
+
+  // Writes out everything pushed so far, from the calling thread.
+  void flush() {
+    std::lock_guard lock(m_drain_mutex);
+    drain();
+  }
+
+  // records dropped by every thread since start
+  uint64_t dropped() {
+    std::lock_guard lock(m_rings_mutex);
+    uint64_t dropped = 0;
+    for (const auto &ring : m_rings) {
+      dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return dropped;
+  }
+
+  ~Logger() {
+    {
+      std::lock_guard lock(m_wake_mutex);
+      m_stop = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+    flush();
+  }
+
+private:
+  Logger() : m_thread([this] { run(); }) {
+  }
+
+  void run() {
+    std::unique_lock wake(m_wake_mutex);
+    while (!m_stop) {
+      m_wake.wait_for(wake, PERIOD, [this] { return m_stop; });
+      wake.unlock();
+      flush();
+      wake.lock();
+    }
+  }
+
+  // m_drain_mutex held
+  void drain() {
+    m_batch.clear();
+    uint64_t dropped = 0;
+    {
+      std::lock_guard lock(m_rings_mutex);
+      for (const auto &ring : m_rings) {
+        const uint64_t end = ring->head.load(std::memory_order_acquire);
+        for (uint64_t k = ring->tail.load(std::memory_order_relaxed); k < end;
+             k++) {
+          m_batch.push_back(ring->records[k % Ring::CAPACITY]);
+        }
+        ring->tail.store(end, std::memory_order_release);
+
+        const uint64_t total = ring->dropped.load(std::memory_order_relaxed);
+        dropped += total - ring->reported;
+        ring->reported = total;
+      }
+    }
+
+    // each ring is in order already, but not against the others
+    std::stable_sort(
+        m_batch.begin(), m_batch.end(),
+        [](const Record &a, const Record &b) { return a.time < b.time; }
+    );
+    for (const Record &r : m_batch) {
+      write(r);
+    }
+    if (dropped > 0) {
+      LOG(WARNING) << "Dropped " << dropped << " log records";
+    }
+  }
+
+  void write(const Record &r) {
+    m_text.str({});
+    std::size_t next = 0;
+    for (const char *c = r.format; *c; c++) {
+      if (c[0] == '{' && c[1] == '}' && next < r.count) {
+        put(r.args[next++]);
+        c++;
+      } else {
+        m_text << *c;
+      }
+    }
+
+    switch (r.level) {
+    case Level::INFO:
+      LOG(INFO) << m_text.str();
+      break;
+    case Level::WARNING:
+      LOG(WARNING) << m_text.str();
+      break;
+    case Level::ERROR:
+      LOG(ERROR) << m_text.str();
+      break;
+    }
+  }
+
+  void put(const Arg &a) {
+    switch (a.type) {
+    case Arg::Int:
+      m_text << a.i;
+      break;
+    case Arg::Uint:
+      m_text << a.u;
+      break;
+    case Arg::Double:
+      m_text << a.d;
+      break;
+    case Arg::Bool:
+      m_text << (a.b ? "true" : "false");
+      break;
+    case Arg::String:
+      m_text << a.s;
+      break;
+    }
+  }
+
+  std::mutex m_rings_mutex;
+  std::vector<std::unique_ptr<Ring>> m_rings;
+
+  std::mutex m_drain_mutex;
+  std::vector<Record> m_batch;
+  std::ostringstream m_text;
+
+  std::mutex m_wake_mutex;
+  std::condition_variable m_wake;
+  bool m_stop = false;
+  std::thread m_thread; // last, so it starts after everything it uses
+};
+
+template <typename... Args>
+void log(Level level, const char *format, const Args &...args) {
+  static_assert(sizeof...(Args) <= Record::MAX_ARGS, "too many log arguments");
+  Record r{};
+  r.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()
+  )
+               .count();
+  r.format = format;
+  r.level = level;
+  r.count = uint8_t(sizeof...(Args));
+  [[maybe_unused]] std::size_t k = 0;
+  ((r.args[k++] = make_arg(args)), ...);
+  Logger::get().ring().push(r);
+}
+
+} // namespace asynclog
+
+#define ALOG(level, ...) ::asynclog::log(::asynclog::Level::level, __VA_ARGS__)
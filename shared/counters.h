@@ -0,0 +1,149 @@
+#pragma once
+
+// Hardware performance counters through perf_event_open, read per thread so
+// that timed phases can also say how many cycles, instructions and misses
+// they took. Where counters can't be opened (not Linux, no PMU in a VM,
+// perf_event_paranoid too strict) read() returns false and nothing else
+// changes.
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace counters {
+
+enum Counter
+{
+  Cycles,
+  Instructions,
+  CacheMisses, // last level cache
+  BranchMisses,
+  TlbMisses, // data TLB, reads
+  COUNT,
+};
+
+inline constexpr const char *NAMES[] = {
+    "cycles", "instructions", "llc_misses", "branch_misses", "dtlb_misses"
+};
+
+using Values = std::array<uint64_t, COUNT>;
+
+// Counting costs a system call per read, so it is off unless asked for.
+inline std::atomic<bool> enabled = false;
+
+// bit c is set once any thread has opened counter c
+inline std::atomic<unsigned> opened = 0;
+
+inline bool available(Counter c) {
+  return opened & (1u << c);
+}
+
+#ifdef __linux__
+
+namespace detail {
+
+inline int open_counter(uint32_t type, uint64_t config, int group) {
+  perf_event_attr attr = {};
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return int(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+}
+
+// One thread's counters, opened as a group so they are scheduled together.
+struct Group {
+  int leader = -1;
+  std::array<int, COUNT> fds;
+  std::array<int, COUNT> order; // counters in the order they were opened
+  int size = 0;
+
+  Group() {
+    static constexpr uint64_t TLB =
+        PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    static constexpr std::pair<uint32_t, uint64_t> events[COUNT] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, TLB},
+    };
+
+    for (int c = 0; c < COUNT; c++) {
+      const int fd = open_counter(events[c].first, events[c].second, leader);
+      if (fd < 0) {
+        if (c == Cycles) {
+          return; // nothing to group under
+        }
+        continue;
+      }
+      if (leader < 0) {
+        leader = fd;
+      }
+      fds[size] = fd;
+      order[size++] = c;
+      opened |= 1u << c;
+    }
+  }
+
+  ~Group() {
+    for (int k = 0; k < size; k++) {
+      close(fds[k]);
+    }
+  }
+
+  bool read(Values &out) const {
+    if (leader < 0) {
+      return false;
+    }
+
+    struct {
+      uint64_t nr;
+      uint64_t enabled;
+      uint64_t running;
+      uint64_t values[COUNT];
+    } data;
+    if (::read(leader, &data, sizeof(data)) < ssize_t(3 * sizeof(uint64_t))) {
+      return false;
+    }
+
+    // scale up if the group was multiplexed with other events
+    const double scale =
+        data.running ? double(data.enabled) / data.running : 0.0;
+    out = {};
+    for (uint64_t k = 0; k < data.nr && k < uint64_t(size); k++) {
+      out[order[k]] = uint64_t(data.values[k] * scale);
+    }
+    return true;
+  }
+};
+
+} // namespace detail
+
+// The calling thread's counters since they were first read.
+inline bool read(Values &out) {
+  thread_local detail::Group group;
+  return group.read(out);
+}
+
+#else
+
+inline bool read(Values &) {
+  return false;
+}
+
+#endif
+
+} // namespace counters
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <SFML/Network/IpAddress.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+#if defined(__linux__)
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#else
+#include <SFML/Network/Socket.hpp>
+#include <SFML/Network/UdpSocket.hpp>
+#endif
+
+// One UDP datagram in a fixed buffer, with where it came from or is going.
+struct Datagram {
+  // an Ethernet frame's worth, more than any balls datagram
+  static constexpr std::size_t CAPACITY = 1500;
+
+  std::array<uint8_t, CAPACITY> data;
+  std::size_t size = 0;
+  sf::IpAddress address = sf::IpAddress::Any;
+  unsigned short port = 0;
+
+  std::span<const uint8_t> bytes() const {
+    return {data.data(), size};
+  }
+};
+
+// A non-blocking UDP socket that moves datagrams in batches. The buffers are
+// a fixed pool of BATCH datagrams each way, reused for every batch, so once
+// the socket exists sending and receiving never allocate. On Linux a whole
+// batch is one recvmmsg or sendmmsg call; elsewhere it's one call per
+// datagram through SFML.
+//
+//   Datagram *d = socket.buffer(); // fill it in
+//   socket.send();                 // queued
+//   socket.flush();                // sent, with everything else queued
+//
+//   while (const Datagram *d = socket.receive()) {
+//     // d is good until the batch after this one is received
+//   }
+class DatagramSocket {
+public:
+  static constexpr std::size_t BATCH = 32;
+
+  DatagramSocket() {
+#if defined(__linux__)
+    for (std::size_t i = 0; i < BATCH; i++) {
+      m_in_iov[i] = {m_in[i].data.data(), Datagram::CAPACITY};
+      m_in_msg[i].msg_hdr.msg_iov = &m_in_iov[i];
+      m_in_msg[i].msg_hdr.msg_iovlen = 1;
+      m_in_msg[i].msg_hdr.msg_name = &m_in_name[i];
+      m_out_iov[i] = {m_out[i].data.data(), 0};
+      m_out_msg[i].msg_hdr.msg_iov = &m_out_iov[i];
+      m_out_msg[i].msg_hdr.msg_iovlen = 1;
+      m_out_msg[i].msg_hdr.msg_name = &m_out_name[i];
+      m_out_msg[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    }
+#endif
+  }
+
+  DatagramSocket(const DatagramSocket &) = delete;
+  DatagramSocket &operator=(const DatagramSocket &) = delete;
+
+  ~DatagramSocket() {
+    flush();
+#if defined(__linux__)
+    if (m_fd >= 0) {
+      ::close(m_fd);
+    }
+#endif
+  }
+
+  // 0 for any free port.
+  bool bind(unsigned short port = 0) {
+#if defined(__linux__)
+    m_fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_fd < 0) {
+      return false;
+    }
+    const sockaddr_in name = to_name(sf::IpAddress::Any, port);
+    const auto *address = reinterpret_cast<const sockaddr *>(&name);
+    if (::bind(m_fd, address, sizeof(name)) != 0) {
+      return false;
+    }
+    return ::fcntl(m_fd, F_SETFL, ::fcntl(m_fd, F_GETFL) | O_NONBLOCK) == 0;
+#else
+    if (m_socket.bind(port) != sf::Socket::Status::Done) {
+      return false;
+    }
+    m_socket.setBlocking(false);
+    return true;
+#endif
+  }
+
+  unsigned short local_port() const {
+#if defined(__linux__)
+    sockaddr_in name = {};
+    socklen_t length = sizeof(name);
+    if (::getsockname(m_fd, reinterpret_cast<sockaddr *>(&name), &length)) {
+      return 0;
+    }
+    return ntohs(name.sin_port);
+#else
+    return m_socket.getLocalPort();
+#endif
+  }
+
+  // The next free buffer to send, flushing the queue if it's full.
+  Datagram *buffer() {
+    if (m_queued == BATCH) {
+      flush();
+    }
+    return &m_out[m_queued];
+  }
+
+  // Queues the buffer buffer() gave last.
+  void send() {
+    m_queued++;
+  }
+
+  // Sends everything queued and returns how many went. One the socket
+  // refuses, say for an address it can't reach, is dropped and the rest
+  // still go; if the socket can't take any more right now, all that's left
+  // is dropped, as the network might have.
+  std::size_t flush() {
+    std::size_t sent = 0;
+#if defined(__linux__)
+    for (std::size_t i = 0; i < m_queued; i++) {
+      m_out_name[i] = to_name(m_out[i].address, m_out[i].port);
+      m_out_iov[i].iov_len = m_out[i].size;
+    }
+    std::size_t next = 0;
+    while (next < m_queued) {
+      const int n = ::sendmmsg(m_fd, &m_out_msg[next], m_queued - next, 0);
+      m_calls++;
+      if (n > 0) {
+        sent += n;
+        next += n;
+      } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      } else if (errno != EINTR) {
+        next++; // the one at `next` failed, on its own
+      }
+    }
+#else
+    for (std::size_t i = 0; i < m_queued; i++) {
+      const Datagram &d = m_out[i];
+      m_calls++;
+      if (m_socket.send(d.data.data(), d.size, d.address, d.port) ==
+          sf::Socket::Status::Done) {
+        sent++;
+      }
+    }
+#endif
+    m_sent += sent;
+    m_dropped += m_queued - sent;
+    m_queued = 0;
+    return sent;
+  }
+
+  // The next datagram waiting, if there is one.
+  const Datagram *receive() {
+    if (m_next == m_received && !refill()) {
+      return nullptr;
+    }
+    return &m_in[m_next++];
+  }
+
+  uint64_t datagrams_sent() const {
+    return m_sent;
+  }
+
+  uint64_t datagrams_received() const {
+    return m_total_received;
+  }
+
+  // queued but never sent
+  uint64_t datagrams_dropped() const {
+    return m_dropped;
+  }
+
+  // system calls made, to see how well batching is doing
+  uint64_t calls() const {
+    return m_calls;
+  }
+
+private:
+  bool refill() {
+    m_next = m_received = 0;
+#if defined(__linux__)
+    for (std::size_t i = 0; i < BATCH; i++) {
+      m_in_msg[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    }
+    const int n =
+        ::recvmmsg(m_fd, m_in_msg.data(), BATCH, MSG_DONTWAIT, nullptr);
+    m_calls++;
+    if (n <= 0) {
+      return false;
+    }
+    for (int i = 0; i < n; i++) {
+      m_in[i].size = m_in_msg[i].msg_len;
+      m_in[i].address = sf::IpAddress(ntohl(m_in_name[i].sin_addr.s_addr));
+      m_in[i].port = ntohs(m_in_name[i].sin_port);
+    }
+    m_received = n;
+#else
+    std::optional<sf::IpAddress> address;
+    m_calls++;
+    if (m_socket.receive(
+            m_in[0].data.data(), Datagram::CAPACITY, m_in[0].size, address,
+            m_in[0].port
+        ) != sf::Socket::Status::Done ||
+        !address) {
+      return false;
+    }
+    m_in[0].address = *address;
+    m_received = 1;
+#endif
+    m_total_received += m_received;
+    return true;
+  }
+
+#if defined(__linux__)
+  static sockaddr_in to_name(sf::IpAddress address, unsigned short port) {
+    sockaddr_in name = {};
+    name.sin_family = AF_INET;
+    name.sin_port = htons(port);
+    name.sin_addr.s_addr = htonl(address.toInteger());
+    return name;
+  }
+
+  int m_fd = -1;
+  std::array<iovec, BATCH> m_in_iov = {};
+  std::array<sockaddr_in, BATCH> m_in_name = {};
+  std::array<mmsghdr, BATCH> m_in_msg = {};
+  std::array<iovec, BATCH> m_out_iov = {};
+  std::array<sockaddr_in, BATCH> m_out_name = {};
+  std::array<mmsghdr, BATCH> m_out_msg = {};
+#else
+  sf::UdpSocket m_socket;
+#endif
+
+  std::array<Datagram, BATCH> m_in;
+  std::size_t m_next = 0;
+  std::size_t m_received = 0;
+  std::array<Datagram, BATCH> m_out;
+  std::size_t m_queued = 0;
+
+  uint64_t m_sent = 0;
+  uint64_t m_dropped = 0;
+  uint64_t m_total_received = 0;
+  uint64_t m_calls = 0;
+};
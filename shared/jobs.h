@@ -0,0 +1,383 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "trace.h"
+
+class JobSystem;
+
+// A frame's work as a DAG of parallel-for jobs. Each job is split into
+// chunks that may run on any thread, and starts once every job it was added
+// after has finished. Chunk boundaries only depend on the job size and the
+// chunk count, so chunked reductions come out the same whichever thread ran
+// which chunk. The graph keeps every job's closure in storage of its own, so
+// jobs are called through a plain pointer, with no std::function to allocate.
+class JobGraph {
+public:
+  // f(begin, end, chunk), on a closure the graph keeps
+  struct Body {
+    void (*call)(void *, std::size_t, std::size_t, std::size_t) = nullptr;
+    void *closure = nullptr;
+
+    void operator()(std::size_t begin, std::size_t end, std::size_t chunk)
+        const {
+      call(closure, begin, end, chunk);
+    }
+  };
+
+  struct Job {
+    Body body;
+    std::size_t size = 0;
+    std::size_t chunks = 0;
+    std::vector<std::size_t> bounds; // explicit chunk boundaries, if any
+    std::vector<Job *> dependents;
+    int dependencies = 0;
+
+    std::atomic<int> waiting = 0;
+    std::atomic<std::size_t> left = 0;
+    JobGraph *graph = nullptr;
+
+    std::size_t begin(std::size_t chunk) const {
+      return bounds.empty() ? size * chunk / chunks : bounds[chunk];
+    }
+  };
+
+  explicit JobGraph(JobSystem &system) : m_system(system) {
+  }
+
+  JobGraph(const JobGraph &) = delete;
+  JobGraph &operator=(const JobGraph &) = delete;
+
+  ~JobGraph() {
+    for (auto d = m_destroy.rbegin(); d != m_destroy.rend(); d++) {
+      d->first(d->second);
+    }
+  }
+
+  // Runs f over [0, n) in `chunks` pieces (by default a few per thread),
+  // after the given jobs. Null entries in `after` are skipped.
+  template <typename F>
+  Job *parallel_for(
+      std::size_t n, F &&f, std::initializer_list<Job *> after = {},
+      std::size_t chunks = 0
+  ) {
+    return insert(n, keep(std::forward<F>(f)), after, chunks);
+  }
+
+  // Runs f with chunk c covering [bounds[c], bounds[c + 1]), for work that
+  // isn't evenly spread over the items.
+  template <typename F>
+  Job *parallel_for(
+      std::vector<std::size_t> bounds, F &&f,
+      std::initializer_list<Job *> after = {}
+  ) {
+    return insert(std::move(bounds), keep(std::forward<F>(f)), after);
+  }
+
+  // A single serial job.
+  template <typename F>
+  Job *add(F &&f, std::initializer_list<Job *> after = {}) {
+    return parallel_for(
+        1,
+        [f = std::forward<F>(f)](
+            std::size_t, std::size_t, std::size_t
+        ) mutable { f(); },
+        after, 1
+    );
+  }
+
+  // Runs every job and returns when they are all done.
+  void run();
+
+  // chunks a job of n items gets by default
+  std::size_t default_chunks(std::size_t n) const;
+
+private:
+  friend class JobSystem;
+
+  // closures are packed into blocks of this many bytes, or one of their own
+  static constexpr std::size_t BLOCK = 1024;
+
+  Job *insert(
+      std::size_t n, Body f, std::initializer_list<Job *> after,
+      std::size_t chunks
+  );
+  Job *insert(
+      std::vector<std::size_t> bounds, Body f,
+      std::initializer_list<Job *> after
+  );
+
+  // Moves f into the graph, for as long as the graph lasts.
+  template <typename F> Body keep(F &&f) {
+    using C = std::decay_t<F>;
+    static_assert(alignof(C) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    C *closure = new (allocate(sizeof(C), alignof(C))) C(std::forward<F>(f));
+    if constexpr (!std::is_trivially_destructible_v<C>) {
+      m_destroy.emplace_back(
+          [](void *c) {
+            static_cast<C *>(c)->~C();
+          },
+          closure
+      );
+    }
+    return {
+        [](void *c, std::size_t begin, std::size_t end, std::size_t chunk) {
+          (*static_cast<C *>(c))(begin, end, chunk);
+        },
+        closure
+    };
+  }
+
+  void *allocate(std::size_t size, std::size_t align) {
+    std::size_t at = (m_used + align - 1) / align * align;
+    if (m_blocks.empty() || at + size > m_capacity) {
+      m_capacity = std::max(size, BLOCK);
+      m_blocks.emplace_back(new std::byte[m_capacity]);
+      at = 0;
+    }
+    m_used = at + size;
+    return m_blocks.back().get() + at;
+  }
+
+  JobSystem &m_system;
+  std::deque<Job> m_jobs;
+  std::atomic<std::size_t> m_remaining = 0;
+
+  std::vector<std::unique_ptr<std::byte[]>> m_blocks;
+  std::size_t m_capacity = 0;
+  std::size_t m_used = 0;
+  std::vector<std::pair<void (*)(void *), void *>> m_destroy;
+};
+
+// Work-stealing scheduler. Every thread owns a deque of ready chunks: it
+// pushes and pops its own at the back and steals from the front of the
+// others' when it runs dry. A thread waiting on a graph keeps running chunks
+// instead of blocking, so jobs may run graphs of their own.
+class JobSystem {
+public:
+  explicit JobSystem(unsigned threads = std::thread::hardware_concurrency())
+    : m_size(std::max(threads, 1u)) {
+    for (unsigned w = 0; w < m_size; w++) {
+      m_queues.push_back(std::make_unique<Queue>());
+    }
+    for (unsigned w = 1; w < m_size; w++) {
+      m_workers.emplace_back([this, w] {
+        work(w);
+      });
+    }
+  }
+
+  ~JobSystem() {
+    {
+      std::lock_guard lock(m_sleep);
+      m_quit = true;
+    }
+    m_wake.notify_all();
+    for (auto &t : m_workers) {
+      t.join();
+    }
+  }
+
+  // threads taking part, including the one that runs a graph
+  unsigned size() const {
+    return m_size;
+  }
+
+  void run(JobGraph &graph) {
+    graph.m_remaining = graph.m_jobs.size();
+    for (JobGraph::Job &job : graph.m_jobs) {
+      job.waiting = job.dependencies;
+      job.left = job.chunks;
+    }
+    for (JobGraph::Job &job : graph.m_jobs) {
+      if (job.dependencies == 0) {
+        schedule(job);
+      }
+    }
+
+    while (graph.m_remaining > 0) {
+      if (!run_one()) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // Runs f(begin, end, chunk) over [0, n) and waits for it.
+  template <typename F> void parallel_for(std::size_t n, F &&f) {
+    if (n == 0) {
+      return;
+    }
+    if (m_size == 1) {
+      f(std::size_t{0}, n, std::size_t{0});
+      return;
+    }
+
+    JobGraph graph(*this);
+    graph.parallel_for(n, std::ref(f));
+    graph.run();
+  }
+
+private:
+  struct Task {
+    JobGraph::Job *job;
+    std::size_t chunk;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  static unsigned &current() {
+    static thread_local unsigned worker = 0;
+    return worker;
+  }
+
+  void schedule(JobGraph::Job &job) {
+    if (job.chunks == 0) {
+      finish(job);
+      return;
+    }
+
+    {
+      Queue &q = *m_queues[current()];
+      std::lock_guard lock(q.mutex);
+      for (std::size_t c = job.chunks; c-- > 0;) {
+        q.tasks.push_back({&job, c});
+      }
+    }
+
+    m_queued += job.chunks;
+    { std::lock_guard lock(m_sleep); }
+    m_wake.notify_all();
+  }
+
+  void finish(JobGraph::Job &job) {
+    for (JobGraph::Job *d : job.dependents) {
+      if (--d->waiting == 0) {
+        schedule(*d);
+      }
+    }
+    job.graph->m_remaining--;
+  }
+
+  bool pop(unsigned w, Task &task) {
+    Queue &own = *m_queues[w];
+    {
+      std::lock_guard lock(own.mutex);
+      if (!own.tasks.empty()) {
+        task = own.tasks.back();
+        own.tasks.pop_back();
+        return true;
+      }
+    }
+
+    for (unsigned i = 1; i < m_size; i++) {
+      Queue &other = *m_queues[(w + i) % m_size];
+      std::lock_guard lock(other.mutex);
+      if (!other.tasks.empty()) {
+        task = other.tasks.front();
+        other.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool run_one() {
+    Task task;
+    if (!pop(current(), task)) {
+      return false;
+    }
+    m_queued--;
+
+    JobGraph::Job &job = *task.job;
+    TRACE_ZONE("job");
+    job.body(job.begin(task.chunk), job.begin(task.chunk + 1), task.chunk);
+    if (--job.left == 0) {
+      finish(job);
+    }
+    return true;
+  }
+
+  void work(unsigned w) {
+    current() = w;
+    for (;;) {
+      if (run_one()) {
+        continue;
+      }
+
+      std::unique_lock lock(m_sleep);
+      m_wake.wait(lock, [this] {
+        return m_quit || m_queued > 0;
+      });
+      if (m_quit) {
+        return;
+      }
+    }
+  }
+
+  unsigned m_size;
+  std::vector<std::unique_ptr<Queue>> m_queues;
+  std::vector<std::thread> m_workers;
+
+  std::atomic<std::size_t> m_queued = 0;
+  std::mutex m_sleep;
+  std::condition_variable m_wake;
+  bool m_quit = false;
+};
+
+inline std::size_t JobGraph::default_chunks(std::size_t n) const {
+  return std::min<std::size_t>(n, 4 * m_system.size());
+}
+
+inline JobGraph::Job *JobGraph::insert(
+    std::size_t n, Body f, std::initializer_list<Job *> after,
+    std::size_t chunks
+) {
+  Job &job = m_jobs.emplace_back();
+  job.body = f;
+  job.size = n;
+  job.chunks = std::min(n, chunks ? chunks : default_chunks(n));
+  job.graph = this;
+  for (Job *a : after) {
+    if (a) {
+      a->dependents.push_back(&job);
+      job.dependencies++;
+    }
+  }
+  return &job;
+}
+
+inline JobGraph::Job *JobGraph::insert(
+    std::vector<std::size_t> bounds, Body f, std::initializer_list<Job *> after
+) {
+  const std::size_t chunks = bounds.size() > 1 ? bounds.size() - 1 : 0;
+  Job *j = insert(chunks ? bounds.back() : 0, f, after, 1);
+  j->chunks = chunks;
+  j->bounds = std::move(bounds);
+  return j;
+}
+
+inline void JobGraph::run() {
+  m_system.run(*this);
+}
+
+inline JobSystem &jobs() {
+  static JobSystem system;
+  return system;
+}
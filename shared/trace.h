@@ -0,0 +1,213 @@
+#pragma once
+
+// Scoped timing zones, exported as Chrome trace events (load the file in
+// chrome://tracing or ui.perfetto.dev).
+//
+//   TRACE_ZONE("collide");
+//
+// records the time from that line to the end of the enclosing scope. Every
+// thread writes into its own ring buffer, so recording takes no locks; only a
+// thread's first zone registers its ring. Built without TRACE_ENABLED the
+// macros expand to nothing.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <x86intrin.h>
+#endif
+
+namespace trace {
+
+// A cheap timestamp: the cycle counter where there is one.
+inline uint64_t now() {
+#if defined(__x86_64__) || defined(_M_X64)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+struct Event {
+  const char *name;
+  uint64_t begin;
+  uint64_t end;
+};
+
+// One thread's events. Only the owner writes; a reader copies the newest
+// entries and then drops any the owner may have overwritten meanwhile. The
+// slots are relaxed atomics so that reading one mid-write is merely stale.
+struct Ring {
+  static constexpr std::size_t CAPACITY = 1 << 16;
+
+  struct Slot {
+    std::atomic<const char *> name;
+    std::atomic<uint64_t> begin;
+    std::atomic<uint64_t> end;
+  };
+
+  std::array<Slot, CAPACITY> slots;
+  std::atomic<uint64_t> head = 0; // events ever written
+  uint32_t thread = 0;
+
+  void push(const Event &e) {
+    const uint64_t h = head.load(std::memory_order_relaxed);
+    Slot &slot = slots[h % CAPACITY];
+    slot.name.store(e.name, std::memory_order_relaxed);
+    slot.begin.store(e.begin, std::memory_order_relaxed);
+    slot.end.store(e.end, std::memory_order_relaxed);
+    head.store(h + 1, std::memory_order_release);
+  }
+
+  Event read(uint64_t k) const {
+    const Slot &slot = slots[k % CAPACITY];
+    return {
+        slot.name.load(std::memory_order_relaxed),
+        slot.begin.load(std::memory_order_relaxed),
+        slot.end.load(std::memory_order_relaxed)
+    };
+  }
+};
+
+class Recorder {
+public:
+  static Recorder &get() {
+    static Recorder recorder;
+    return recorder;
+  }
+
+  Ring &ring() {
+    thread_local Ring *mine = nullptr;
+    if (!mine) {
+      std::lock_guard lock(m_mutex);
+      m_rings.push_back(std::make_unique<Ring>());
+      mine = m_rings.back().get();
+      mine->thread = uint32_t(m_rings.size() - 1);
+    }
+    return *mine;
+  }
+
+  // Writes everything still in the rings as a Chrome trace.
+  void write(std::ostream &out) {
+    const double us_per_tick = calibrate();
+
+    out << "{\"traceEvents\": [\n";
+    bool first = true;
+
+    std::lock_guard lock(m_mutex);
+    for (const auto &ring : m_rings) {
+      const uint64_t end = ring->head.load(std::memory_order_acquire);
+      const uint64_t begin = end > Ring::CAPACITY ? end - Ring::CAPACITY : 0;
+      std::vector<Event> copy;
+      copy.reserve(end - begin);
+      for (uint64_t k = begin; k < end; k++) {
+        copy.push_back(ring->read(k));
+      }
+
+      // whatever was written while copying may have replaced the oldest
+      std::atomic_thread_fence(std::memory_order_acquire);
+      const uint64_t after = ring->head.load(std::memory_order_relaxed);
+      const uint64_t lost =
+          after > begin + Ring::CAPACITY ? after - begin - Ring::CAPACITY : 0;
+
+      out << (first ? "" : ",\n")
+          << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": "
+          << ring->thread << ", \"args\": {\"name\": \"thread "
+          << ring->thread << "\"}}";
+      first = false;
+
+      for (std::size_t k = std::min<uint64_t>(lost, copy.size());
+           k < copy.size(); k++) {
+        const Event &e = copy[k];
+        out << ",\n{\"name\": \"" << e.name
+            << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << ring->thread
+            << ", \"ts\": " << since_start(e.begin) * us_per_tick
+            << ", \"dur\": " << (e.end - e.begin) * us_per_tick << "}";
+      }
+    }
+
+    out << "\n]}\n";
+  }
+
+  bool write(const char *path) {
+    std::ofstream out(path);
+    write(out);
+    return bool(out);
+  }
+
+private:
+  Recorder()
+    : m_start(now()), m_start_time(std::chrono::steady_clock::now()) {
+  }
+
+  // never before the start, even for a clock that isn't quite in step
+  // across cores
+  uint64_t since_start(uint64_t ticks) const {
+    return ticks > m_start ? ticks - m_start : 0;
+  }
+
+  // microseconds per tick of now(), from the ticks and time since start
+  double calibrate() const {
+    const uint64_t ticks = now() - m_start;
+    const std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - m_start_time;
+    return ticks ? elapsed.count() / ticks : 0.0;
+  }
+
+  uint64_t m_start;
+  std::chrono::steady_clock::time_point m_start_time;
+  std::mutex m_mutex;
+  std::vector<std::unique_ptr<Ring>> m_rings;
+};
+
+// Records its own lifetime. The name must outlive the trace, e.g. a literal.
+// The ring is fetched before the clock is read, so the Recorder, and the
+// start the trace is timed from, always come before the first zone.
+class Zone {
+public:
+  explicit Zone(const char *name)
+    : m_ring(Recorder::get().ring()), m_name(name), m_begin(now()) {
+  }
+
+  ~Zone() {
+    m_ring.push({m_name, m_begin, now()});
+  }
+
+  Zone(const Zone &) = delete;
+  Zone &operator=(const Zone &) = delete;
+
+private:
+  Ring &m_ring;
+  const char *m_name;
+  uint64_t m_begin;
+};
+
+// Writes the trace to a file; false if there's nothing to write or it failed.
+inline bool save(const char *path) {
+#ifdef TRACE_ENABLED
+  return Recorder::get().write(path);
+#else
+  (void)path;
+  return false;
+#endif
+}
+
+} // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef TRACE_ENABLED
+#define TRACE_ZONE(name)                                                       \
+  ::trace::Zone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+#else
+#define TRACE_ZONE(name)
+#endif
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Fixed layouts on the wire. A struct goes on the wire once Wire<T> lists its
+// fields, in order:
+//
+//   template <> struct Wire<Move> {
+//     static constexpr auto fields = std::tuple{&Move::id, &Move::x, &Move::y};
+//   };
+//
+// Fields are packed with no padding and stored little endian whatever the
+// host, so the layout doesn't depend on the compiler, and every offset is
+// known at compile time. Reading goes through View<T>, which loads a field
+// straight from the buffer it came in with memcpy, so the buffer needn't be
+// aligned and nothing is copied but the field. A buffer longer than the
+// layout is fine: newer versions can add fields at the end and older ones
+// read what they know.
+
+using byte = uint8_t;
+
+template <typename T> struct Wire;
+
+template <typename T>
+concept WireField =
+    (std::is_arithmetic_v<T> || std::is_enum_v<T>) && !std::is_same_v<T, bool>;
+
+namespace wire_detail {
+
+template <std::size_t N> struct Unsigned;
+template <> struct Unsigned<1> {
+  using type = uint8_t;
+};
+template <> struct Unsigned<2> {
+  using type = uint16_t;
+};
+template <> struct Unsigned<4> {
+  using type = uint32_t;
+};
+template <> struct Unsigned<8> {
+  using type = uint64_t;
+};
+
+template <typename M> struct Member;
+template <typename C, typename F> struct Member<F C::*> {
+  using type = F;
+};
+
+template <typename U> U little_endian(U u) {
+  if constexpr (std::endian::native == std::endian::big) {
+    U swapped = 0;
+    for (std::size_t b = 0; b < sizeof(U); b++) {
+      swapped = U(swapped << 8 | ((u >> (8 * b)) & 0xff));
+    }
+    return swapped;
+  } else {
+    return u;
+  }
+}
+
+template <typename A, typename B> constexpr bool same(A a, B b) {
+  if constexpr (std::is_same_v<A, B>) {
+    return a == b;
+  } else {
+    return false;
+  }
+}
+
+} // namespace wire_detail
+
+// A value stored little endian at any address. On a little endian host it's
+// one unaligned load.
+template <WireField T> T load_le(const byte *at) {
+  using U = typename wire_detail::Unsigned<sizeof(T)>::type;
+  U u;
+  std::memcpy(&u, at, sizeof(U));
+  return std::bit_cast<T>(wire_detail::little_endian(u));
+}
+
+template <WireField T> void store_le(byte *at, T value) {
+  const auto u = wire_detail::little_endian(
+      std::bit_cast<typename wire_detail::Unsigned<sizeof(T)>::type>(value)
+  );
+  std::memcpy(at, &u, sizeof(u));
+}
+
+template <typename T>
+inline constexpr std::size_t wire_fields =
+    std::tuple_size_v<std::remove_const_t<decltype(Wire<T>::fields)>>;
+
+// the type of T's I-th field
+template <typename T, std::size_t I>
+using wire_field = typename wire_detail::Member<std::tuple_element_t<
+    I, std::remove_const_t<decltype(Wire<T>::fields)>>>::type;
+
+// where T's I-th field starts
+template <typename T, std::size_t I>
+inline constexpr std::size_t wire_offset =
+    []<std::size_t... K>(std::index_sequence<K...>) {
+      return (std::size_t(0) + ... + sizeof(wire_field<T, K>));
+    }(std::make_index_sequence<I>());
+
+template <typename T>
+inline constexpr std::size_t wire_size = wire_offset<T, wire_fields<T>>;
+
+// which of T's fields Member is, or wire_fields<T> if it isn't one
+template <typename T, auto Member>
+inline constexpr std::size_t wire_index =
+    []<std::size_t... K>(std::index_sequence<K...>) {
+      std::size_t index = wire_fields<T>;
+      ((wire_detail::same(std::get<K>(Wire<T>::fields), Member) ? index = K
+                                                                 : 0),
+       ...);
+      return index;
+    }(std::make_index_sequence<wire_fields<T>>());
+
+// Writes t's fields to out, which needs wire_size<T> bytes.
+template <typename T> void Serialise(const T &t, byte *out) {
+  [&]<std::size_t... K>(std::index_sequence<K...>) {
+    (store_le(out + wire_offset<T, K>, t.*std::get<K>(Wire<T>::fields)), ...);
+  }(std::make_index_sequence<wire_fields<T>>());
+}
+
+template <typename T> std::array<byte, wire_size<T>> Serialise(const T &t) {
+  std::array<byte, wire_size<T>> out;
+  Serialise(t, out.data());
+  return out;
+}
+
+// A T read in place, from a buffer that outlives it.
+template <typename T> class View {
+public:
+  static constexpr std::size_t SIZE = wire_size<T>;
+
+  // A view of the start of `data`, if it's long enough.
+  static std::optional<View> of(std::span<const byte> data) {
+    if (data.size() < SIZE) {
+      return std::nullopt;
+    }
+    return View(data.data());
+  }
+
+  template <auto Member> auto get() const {
+    constexpr std::size_t index = wire_index<T, Member>;
+    static_assert(index < wire_fields<T>, "not one of Wire<T>::fields");
+    return load_le<wire_field<T, index>>(m_data + wire_offset<T, index>);
+  }
+
+  // every field, as a T
+  T value() const {
+    T t{};
+    [&]<std::size_t... K>(std::index_sequence<K...>) {
+      ((t.*std::get<K>(Wire<T>::fields) =
+            load_le<wire_field<T, K>>(m_data + wire_offset<T, K>)),
+       ...);
+    }(std::make_index_sequence<wire_fields<T>>());
+    return t;
+  }
+
+private:
+  explicit View(const byte *data) : m_data(data) {
+  }
+
+  const byte *m_data;
+};
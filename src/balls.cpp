@@ -21,218 +21,288 @@
 #include <SFML/Window/Keyboard.hpp>
 #include <SFML/Window/Window.hpp>
 
-#include <functional>
-#include <iostream>
-#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
 #include <vector>
 
 #include <easylogging++.h>
 INITIALIZE_EASYLOGGINGPP
 
+#include "perf.h"
+COUNT_ALLOCATIONS
+
+#include "client.h"
+#include "counters.h"
 #include "entity.h"
+#include "simulation.h"
+#include "trace.h"
 #include "world.h"
 
-struct State {
-  std::vector<Entity> entities;
-  uint64_t frame = 0;
-  int bounce = 0;
-  std::optional<float> energy = std::nullopt;
-  sf::Vector2f center_of_mass;
-
-  sf::Vector2f camera_position = {0.0, 0.0};
-
-  bool enable_gravity = true;
-  float gravity = 1e2;
-
-  bool enable_walls = true;
-
-  float elasticity = 1.0f;
-  float drag = 0.0f;
-} state;
+// Fast forward: more than one step per rendered frame, only the last of which
+// is drawn.
+enum class Warp
+{
+  Off,
+  // a fixed number of steps per frame
+  Multiplier,
+  // as many steps as fit in the budget
+  Budget,
+};
+
+inline constexpr const char *WARP_NAMES[] = {"Off", "Multiplier", "Budget"};
+
+struct TimeWarp {
+  Warp mode = Warp::Off;
+  int multiplier = 4;
+  // ms of stepping per frame, in either mode, so the window keeps up
+  float budget = 12.0f;
+
+  // simulated seconds per wall second, measured over about half a second
+  float rate = 1.0f;
+  float simulated = 0;
+  float wall = 0;
+};
+
+static constexpr float FIXED_STEP = 1.0f / 60.0f;
+
+TimeWarp warp;
+
+// set when balls is a thin client of a balls_server
+std::optional<Client> client;
+
+void advance(float delta_time) {
+  TRACE_ZONE("advance");
+  const auto start = std::chrono::steady_clock::now();
+  auto over_budget = [&] {
+    const std::chrono::duration<float, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() >= warp.budget;
+  };
+
+  float simulated = 0;
+  switch (warp.mode) {
+  case Warp::Off:
+    simulated = std::min(delta_time, FIXED_STEP);
+    simulate(simulated);
+    break;
+
+  case Warp::Multiplier:
+    for (int i = 0; i < warp.multiplier; i++) {
+      simulate(FIXED_STEP);
+      simulated += FIXED_STEP;
+      if (over_budget()) {
+        break;
+      }
+    }
+    break;
+
+  case Warp::Budget:
+    do {
+      simulate(FIXED_STEP);
+      simulated += FIXED_STEP;
+    } while (!over_budget());
+    break;
+  }
 
-void reset_state() {
-  state.frame = 0;
-  state.energy = std::nullopt;
-  state.entities.clear();
+  warp.simulated += simulated;
+  warp.wall += delta_time;
+  if (warp.wall >= 0.5f) {
+    warp.rate = warp.simulated / warp.wall;
+    warp.simulated = warp.wall = 0;
+  }
 }
 
-void reset_small() {
-  reset_state();
-
-  std::random_device r;
-  std::default_random_engine e(r());
-  std::uniform_real_distribution<float> wg(100, WORLD_WIDTH - 100);
-  std::uniform_real_distribution<float> hg(100, WORLD_HEIGHT - 100);
-  std::uniform_real_distribution<float> sg(5, 20);
-  std::uniform_real_distribution<float> dg(1.0f, 5.0f);
-  std::uniform_int_distribution<int> cg(0, 255);
-
-  for (int i = 0; i < 100; i++) {
-    state.entities.emplace_back(
-        sf::Vector2f{wg(e), hg(e)}, sf::Vector2f{0, 0}, sg(e), dg(e),
-        sf::Color(cg(e), cg(e), cg(e))
-    );
+void warp_panel() {
+  int mode = static_cast<int>(warp.mode);
+  if (ImGui::Combo("Fast Forward", &mode, WARP_NAMES, 3)) {
+    warp.mode = static_cast<Warp>(mode);
+  }
+  if (warp.mode == Warp::Multiplier) {
+    ImGui::SliderInt("Steps per Frame", &warp.multiplier, 1, 1000);
+  }
+  if (warp.mode != Warp::Off) {
+    ImGui::SliderFloat("Warp Budget", &warp.budget, 1.0f, 30.0f, "%.1f ms");
   }
+  ImGui::Text("%.1f sim-seconds per wall-second", warp.rate);
 }
 
-void reset_big() {
-  reset_state();
+void governor_panel() {
+  Governor &g = state.governor;
+  Fidelity &f = state.fidelity;
+
+  ImGui::Checkbox("Frame Budget Governor", &g.enabled);
+  if (g.enabled) {
+    ImGui::SliderFloat("Budget", &g.budget, 1.0f, 33.0f, "%.1f ms");
+    ImGui::SliderInt("Max Substeps", &g.max_substeps, 1, 8);
+    ImGui::Text(
+        "Level %zu/%zu: %s gravity, theta %.2f, %d substeps", g.level() + 1,
+        g.levels(), GRAVITY_SOLVER_NAMES[static_cast<int>(f.gravity)], f.theta,
+        f.substeps
+    );
+    ImGui::Text("Simulation: %.2f ms per frame", g.average());
+  } else {
+    int gravity = static_cast<int>(f.gravity);
+    if (ImGui::Combo("Gravity Solver", &gravity, GRAVITY_SOLVER_NAMES, 2)) {
+      f.gravity = static_cast<GravitySolver>(gravity);
+    }
+    if (f.gravity == GravitySolver::Tree) {
+      ImGui::SliderFloat("Theta", &f.theta, 0.0f, 1.5f);
+    }
+    ImGui::SliderInt("Substeps", &f.substeps, 1, 8);
+  }
 
-  state.entities.emplace_back(
-      sf::Vector2f{150.0f, 200.0f}, sf::Vector2f{0, 0}, 50, 50, sf::Color::Green
-  );
-  state.entities.emplace_back(
-      sf::Vector2f{300.0f, 290.0f}, sf::Vector2f{-50, 0}, 50, 50, sf::Color::Red
-  );
+  for (std::size_t p = 0; p < PhaseTimes::PHASES; p++) {
+    ImGui::Text(
+        "%s: %.2f ms", PHASE_NAMES[p], state.phases.ms(static_cast<Phase>(p))
+    );
+  }
 }
 
-void reset_orbit() {
-  reset_state();
-
-  state.entities.emplace_back(
-      sf::Vector2f{450.0f, 450.0f}, sf::Vector2f{0, 0}, 50, 500,
-      sf::Color::Green
+void plot(const char *label, std::size_t series) {
+  const PerfHistory &h = state.perf;
+  const Percentiles p = h.percentiles(series);
+  ImGui::Text(
+      "%s: p50 %.2f, p95 %.2f, p99 %.2f, max %.2f ms", label, p.p50, p.p95,
+      p.p99, p.max
   );
-  state.entities.emplace_back(
-      sf::Vector2f{250.0f, 450.0f}, sf::Vector2f{0, 1600}, 50, 0.05f,
-      sf::Color::Red
+  ImGui::PlotLines(
+      label, h.data(series), static_cast<int>(h.capacity()),
+      static_cast<int>(h.offset()), nullptr, 0.0f, p.max, ImVec2(0, 40)
   );
 }
 
-void drag_entity(Entity &e) {
-  e.velocity() *= 1 - state.drag;
-}
-
-void collide_with_walls(Entity &e) {
-  const float dist_from_ground = WORLD_HEIGHT - e.position().y - e.diameter();
-  if (dist_from_ground <= 0) {
-    e.velocity().y *= -1 * state.elasticity;
-    e.position().y = WORLD_HEIGHT - e.diameter();
+// IPC and misses per body-step in each phase of the last frame.
+void counters_table(const PerfHistory::Frame &last) {
+  bool enabled = counters::enabled;
+  if (ImGui::Checkbox("Hardware Counters", &enabled)) {
+    counters::enabled = enabled;
   }
-
-  if (e.position().y <= 0) {
-    e.velocity().y *= -1 * state.elasticity;
-    e.position().y = 0;
+  if (!enabled) {
+    return;
   }
-
-  if (e.position().x <= 0) {
-    e.velocity().x *= -1 * state.elasticity;
-    e.position().x = 0;
-    state.bounce += 1;
+  // counters are opened by the first phase timed with them on
+  if (last.steps > 0 && !counters::available(counters::Cycles)) {
+    ImGui::TextDisabled("Hardware counters are unavailable");
+    return;
   }
 
-  const float dist_from_right = WORLD_WIDTH - e.position().x - e.diameter();
-  if (dist_from_right <= 0) {
-    e.velocity().x *= -1 * state.elasticity;
-    e.position().x = WORLD_WIDTH - e.diameter();
+  if (ImGui::BeginTable("Counters", 5)) {
+    for (const char *heading :
+         {"Phase", "IPC", "LLC misses", "Branch misses", "dTLB misses"}) {
+      ImGui::TableSetupColumn(heading);
+    }
+    ImGui::TableHeadersRow();
+    for (std::size_t p = 0; p < PhaseTimes::PHASES; p++) {
+      const Phase phase = static_cast<Phase>(p);
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(PHASE_NAMES[p]);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.2f", last.ipc(phase));
+      for (auto c : {counters::CacheMisses, counters::BranchMisses,
+                     counters::TlbMisses}) {
+        ImGui::TableNextColumn();
+        if (counters::available(c)) {
+          ImGui::Text("%.3f", last.per_body_step(phase, c));
+        } else {
+          ImGui::TextDisabled("-");
+        }
+      }
+    }
+    ImGui::EndTable();
   }
 }
 
-void collide_with_entity(Entity &a, Entity &b) {
-  if (!a.collides(b))
+void performance_panel() {
+  if (!ImGui::Begin("Performance")) {
+    ImGui::End();
     return;
+  }
 
-  const sf::Vector2f normal = (b.center() - a.center()).normalized();
-  const sf::Vector2f tangent = {-normal.y, normal.x};
-
-  // move balls apart until they're no longer touching
-  float overlap = a.radius() + b.radius() - (a.center() - b.center()).length();
-
-  float sa = a.velocity().length();
-  float sb = b.velocity().length();
-  if (sa == 0 && sb == 0) {
-    a.position() -= overlap * normal * 0.5f;
-    b.position() += overlap * normal * 0.5f;
-  } else {
-    a.position() -= overlap * normal * sa / (sa + sb);
-    b.position() += overlap * normal * sb / (sa + sb);
-  }
-
-  // inverse total mass
-  const float itm = 1.0 / (a.mass() + b.mass());
-
-  // the normal/tangent components of the collision.
-  const sf::Vector2f van = a.velocity().projectedOnto(normal);
-  const sf::Vector2f vbn = b.velocity().projectedOnto(normal);
-  const sf::Vector2f vat = a.velocity().projectedOnto(tangent);
-  const sf::Vector2f vbt = b.velocity().projectedOnto(tangent);
-
-  // Derived from conservation of momentum
-  a.velocity() = ((a.mass() - b.mass()) * itm * van + 2 * b.mass() * itm * vbn
-                 ) * state.elasticity +
-                 vat;
-  b.velocity() = ((b.mass() - a.mass()) * itm * vbn + 2 * a.mass() * itm * van
-                 ) * state.elasticity +
-                 vbt;
-}
-
-// returns the potential energy of the two entities
-float gravity(Entity &a, Entity &b) {
-  sf::Vector2f dist = a.center() - b.center();
+  PerfHistory &h = state.perf;
+  int window = static_cast<int>(h.capacity());
+  if (ImGui::SliderInt("Frames", &window, 60, 1200)) {
+    h.resize(window);
+  }
 
-  sf::Vector2f force = state.gravity * a.mass() * b.mass() * dist.normalized() /
-                       dist.lengthSquared();
+  const PerfHistory::Frame &last = h.last();
+  const float seconds = h.sum(PerfHistory::FRAME) / 1000;
+  ImGui::Text(
+      "%.0f fps, %.0f steps/s, %zu bodies",
+      seconds > 0 ? h.size() / seconds : 0.0f,
+      seconds > 0 ? h.sum(PerfHistory::STEPS) / seconds : 0.0f, last.bodies
+  );
+  ImGui::Text(
+      "Candidates: %llu, contacts: %llu per frame",
+      static_cast<unsigned long long>(last.candidates),
+      static_cast<unsigned long long>(last.contacts)
+  );
+  ImGui::Text(
+      "Allocations: %llu per frame",
+      static_cast<unsigned long long>(last.allocations)
+  );
 
-  a.push(-force);
-  b.push(force);
+  plot("Frame", PerfHistory::FRAME);
+  plot("Simulation", PerfHistory::SIMULATION);
+  for (std::size_t p = 0; p < PhaseTimes::PHASES; p++) {
+    plot(PHASE_NAMES[p], PerfHistory::phase(static_cast<Phase>(p)));
+  }
 
-  return state.gravity * a.mass() * b.mass() / dist.length();
+  counters_table(last);
+  ImGui::End();
 }
 
-// Uniquely combines elements in v
-template <typename T>
-void combine(std::vector<T> &v, std::function<void(T &, T &)> f) {
-  if (v.size() < 2)
+void diagnostics_panel() {
+  Diagnostics &d = state.diagnostics;
+  d.visible = ImGui::Begin("Diagnostics");
+  if (!d.visible) {
+    ImGui::End();
     return;
-
-  uint32_t j = 1;
-  for (uint32_t i = 0; i < v.size() - 1;) {
-    for (; j < v.size(); j++) {
-      f(v[i], v[j]);
-    }
-    i++;
-    j = i + 1;
   }
-}
 
-void tick(float delta_time) {
-  float energy = 0;
+  ImGui::Checkbox("Enable Diagnostics", &d.enabled);
+  ImGui::SliderInt("Sample Every", &d.sample_every, 1, 120, "%d frames");
+  ImGui::Checkbox("Only When Visible", &d.only_when_visible);
+  ImGui::SliderFloat(
+      "Drift Alarm", &d.drift_threshold, 0.0f, 0.1f, "%.3f",
+      ImGuiSliderFlags_Logarithmic
+  );
 
-  // kinetic
-  for (Entity &e : state.entities) {
-    energy += e.mass() * e.velocity().lengthSquared() * 0.5;
+  if (const auto &s = d.last()) {
+    ImGui::Text("Frame: %llu", static_cast<unsigned long long>(s->frame));
+    ImGui::Text(
+        "Energy: %.4g (kinetic %.4g, potential %.4g)", s->energy(), s->kinetic,
+        s->potential
+    );
+    ImGui::Text("Drift: %.3f%%", 100 * d.drift());
+    ImGui::Text("Momentum: (%.4g, %.4g)", s->momentum.x, s->momentum.y);
+    ImGui::Text("Angular Momentum: %.4g", s->angular_momentum);
+    ImGui::Text(
+        "Center of Mass: (%.1f, %.1f)", s->center_of_mass.x, s->center_of_mass.y
+    );
+    ImGui::Text("Virial Ratio: %.3f", s->virial_ratio());
   }
-
-  combine<Entity>(state.entities, [&](Entity &a, Entity &b) -> void {
-    collide_with_entity(a, b);
-
-    // Gravitational potential
-    if (state.enable_gravity) {
-      energy += gravity(a, b);
-    }
-  });
-
-  if (!state.energy) {
-    state.energy = energy;
-    std::cout << "Total Energy of System: " << energy << std::endl;
+  if (d.alarm()) {
+    ImGui::TextColored({1, 0.3f, 0.3f, 1}, "Energy is drifting");
   }
-
-  sf::Vector2f mv = {0, 0};
-  float mt = 0;
-  for (Entity &e : state.entities) {
-    if (state.enable_walls)
-      collide_with_walls(e);
-
-    drag_entity(e);
-    e.tick(delta_time);
-
-    mv += e.mass() * e.center();
-    mt += e.mass();
+  if (ImGui::Button("Reset Reference")) {
+    d.reset();
   }
+  ImGui::End();
+}
 
-  if (mt != 0) {
-    state.center_of_mass = mv / mt;
+void save_trace() {
+  if (trace::save("trace.json")) {
+    LOG(INFO) << "Saved trace.json";
   }
+}
+
+void tick(float delta_time) {
+  advance(delta_time);
+
+  TRACE_ZONE("ui");
 
   ImGui::Begin("Controls");
 
@@ -242,6 +312,8 @@ void tick(float delta_time) {
   ImGui::SliderFloat("Camera (x)", &state.camera_position.x, -1000.0f, 1000.0f);
   ImGui::SliderFloat("Camera (y)", &state.camera_position.y, -1000.0f, 1000.0f);
 
+  warp_panel();
+
   ImGui::Checkbox("Enable Gravity", &state.enable_gravity);
 
   if (state.enable_gravity) {
@@ -250,6 +322,56 @@ void tick(float delta_time) {
   }
 
   ImGui::Checkbox("Enable Walls", &state.enable_walls);
+  ImGui::Checkbox("Enable Collisions", &state.enable_collisions);
+
+  if (state.enable_collisions) {
+    CollisionPairs &c = state.collisions;
+    int broadphase = static_cast<int>(c.broadphase);
+    if (ImGui::Combo("Broadphase", &broadphase, BROADPHASE_NAMES, 3)) {
+      c.broadphase = static_cast<Broadphase>(broadphase);
+    }
+
+    if (c.broadphase == Broadphase::SweepAndPrune) {
+      ImGui::Checkbox("Sweep Both Axes", &c.sweep.both_axes);
+      ImGui::Text(
+          "Sweep: %zu pairs, %llu swaps, %.1f%% hits", c.candidates(),
+          static_cast<unsigned long long>(c.sweep.swaps()), 100 * c.hit_rate()
+      );
+    } else {
+      ImGui::SliderFloat("Neighbour Skin", &c.neighbours.skin, 0.0f, 50.0f);
+      ImGui::Text(
+          "Neighbour list: %zu pairs, %.1f%% rebuilds, %.1f%% hits",
+          c.candidates(), 100 * c.neighbours.rebuild_rate(), 100 * c.hit_rate()
+      );
+    }
+
+    int solver = static_cast<int>(state.solver);
+    if (ImGui::Combo("Solver", &solver, CONTACT_SOLVER_NAMES, 2)) {
+      state.solver = static_cast<ContactSolver>(solver);
+    }
+    ImGui::SliderInt("Solver Iterations", &state.solver_iterations, 1, 8);
+    if (state.solver == ContactSolver::Impulse) {
+      ImGui::Checkbox("Warm Start", &state.warm_start);
+      ImGui::Text(
+          "Warm started: %.1f%%, velocity error: %.3f",
+          100 * state.contact_cache.warm_rate(), state.solver_error
+      );
+    }
+    ImGui::Text(
+        "Contacts: %zu in %zu colours", state.contacts.size(),
+        state.contacts.colours()
+    );
+    ImGui::Separator();
+  }
+
+  if (state.zones.zones() > 1) {
+    ImGui::Text(
+        "Cost zones: %zu, imbalance %.2f (estimated %.2f)", state.zones.zones(),
+        state.zones.imbalance(), state.zones.estimated_imbalance()
+    );
+  }
+
+  governor_panel();
 
   if (ImGui::Button("Little Balls")) {
     reset_small();
@@ -261,26 +383,157 @@ void tick(float delta_time) {
   if (ImGui::Button("Orbit")) {
     reset_orbit();
   }
+#ifdef TRACE_ENABLED
+  if (ImGui::Button("Save Trace")) {
+    save_trace();
+  }
+#endif
+  ImGui::End();
+
+  diagnostics_panel();
+  performance_panel();
+}
+
+// The thin client's only controls: the camera, and what the server says.
+void client_tick() {
+  const sf::Vector2f screen = {float(WORLD_WIDTH), float(WORLD_HEIGHT)};
+  client->look(-state.camera_position, screen);
+  client->poll();
+
+  ImGui::Begin("Server");
+  ImGui::SliderFloat("Camera (x)", &state.camera_position.x, -1000.0f, 1000.0f);
+  ImGui::SliderFloat("Camera (y)", &state.camera_position.y, -1000.0f, 1000.0f);
+  if (const auto &session = client->session()) {
+    ImGui::Text(
+        "Session %u at %u ticks per second", session->session,
+        session->tick_rate
+    );
+    ImGui::Text(
+        "Tick %llu, %zu bodies",
+        static_cast<unsigned long long>(client->tick()), client->bodies().size()
+    );
+    ImGui::Text(
+        "Receiving %.1f KB/s, %.2f bytes per body",
+        client->bytes_per_second() / 1000, client->bytes_per_body()
+    );
+    const JitterBuffer &buffer = client->buffer();
+    ImGui::Text(
+        "Drawing %.0f ms behind, %.1f ms jitter, %zu extrapolated",
+        buffer.delay() * 1000, buffer.jitter() * 1000, buffer.extrapolated()
+    );
+    const Reassembler &fragments = client->reassembler();
+    ImGui::Text(
+        "Fragmented: %llu whole, %llu rebuilt, %llu dropped",
+        static_cast<unsigned long long>(fragments.completed()),
+        static_cast<unsigned long long>(fragments.recovered()),
+        static_cast<unsigned long long>(fragments.expired())
+    );
+    for (Channel c : {Channel::Unreliable, Channel::Reliable}) {
+      const ChannelStats &stats = client->endpoint().stats(c);
+      ImGui::Text(
+          "%s: %.1f ms round trip, %.1f%% lost, %llu resent",
+          CHANNEL_NAMES[int(c)], stats.rtt * 1000, stats.loss() * 100,
+          static_cast<unsigned long long>(stats.resent)
+      );
+    }
+  } else {
+    ImGui::Text("Connecting...");
+  }
   ImGui::End();
 }
 
 void render(sf::RenderWindow *window) {
+  TRACE_ZONE("render");
+  if (client) {
+    client->draw(window, state.camera_position);
+  }
   for (auto &e : state.entities) {
     e.draw(window, state.camera_position);
   }
 
-  sf::RectangleShape s{{6, 6}};
-  s.setFillColor(sf::Color::White);
-  s.setPosition(
-      state.center_of_mass + state.camera_position - sf::Vector2f{3, 3}
-  );
-  window->draw(s);
+  if (const auto &sample = state.diagnostics.last()) {
+    sf::RectangleShape s{{6, 6}};
+    s.setFillColor(sf::Color::White);
+    s.setPosition(
+        sample->center_of_mass + state.camera_position - sf::Vector2f{3, 3}
+    );
+    window->draw(s);
+  }
 
   ImGui::SFML::Render(*window);
   window->display();
 }
 
-int main() {
+void poll_events(sf::RenderWindow &window) {
+  TRACE_ZONE("events");
+  while (const std::optional event = window.pollEvent()) {
+    ImGui::SFML::ProcessEvent(window, *event);
+
+    // "close requested" event: we close the window
+    if (event->is<sf::Event::Closed>()) {
+      window.close();
+    }
+
+    // drag a ball around on the server
+    if (client && !ImGui::GetIO().WantCaptureMouse) {
+      if (auto e = event->getIf<sf::Event::MouseButtonPressed>()) {
+        client->pick(sf::Vector2f(e->position) - state.camera_position);
+      }
+      if (auto e = event->getIf<sf::Event::MouseMoved>()) {
+        client->move(sf::Vector2f(e->position) - state.camera_position);
+      }
+      if (event->is<sf::Event::MouseButtonReleased>()) {
+        client->release();
+      }
+    }
+
+    if (auto e = event->getIf<sf::Event::KeyPressed>()) {
+      if (e->code == sf::Keyboard::Key::Escape) {
+        window.close();
+      }
+      if (e->code == sf::Keyboard::Key::R) {
+        reset_state();
+      }
+      if (e->code == sf::Keyboard::Key::T) {
+        save_trace();
+      }
+      if (e->code == sf::Keyboard::Key::Right) {
+        state.camera_position.x += 1.0f;
+      }
+      if (e->code == sf::Keyboard::Key::Left) {
+        state.camera_position.x -= 1.0f;
+      }
+      if (e->code == sf::Keyboard::Key::Down) {
+        state.camera_position.y += 1.0f;
+      }
+      if (e->code == sf::Keyboard::Key::Up) {
+        state.camera_position.y -= 1.0f;
+      }
+    }
+  }
+}
+
+// balls [-c server address] [-p port]
+int main(int argc, char **argv) {
+  const char *server = nullptr;
+  unsigned short port = DEFAULT_PORT;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!std::strcmp(argv[i], "-c")) {
+      server = argv[i + 1];
+    } else if (!std::strcmp(argv[i], "-p")) {
+      port = static_cast<unsigned short>(std::atoi(argv[i + 1]));
+    }
+  }
+
+  if (server) {
+    const auto address = sf::IpAddress::resolve(server);
+    if (!address) {
+      LOG(ERROR) << "Couldn't resolve " << server;
+      return 1;
+    }
+    client.emplace(*address, port);
+  }
+
   sf::RenderWindow window(sf::VideoMode({WORLD_WIDTH, WORLD_HEIGHT}), "Balls");
   // window.setVerticalSyncEnabled(true);
 
@@ -292,46 +545,29 @@ int main() {
 
   // run the program as long as the window is open
   while (window.isOpen()) {
+    TRACE_ZONE("frame");
+    const auto frame_start = std::chrono::steady_clock::now();
+
     // check all the window's events that were triggered since the last
     // iteration of the loop
-    while (const std::optional event = window.pollEvent()) {
-      ImGui::SFML::ProcessEvent(window, *event);
-
-      // "close requested" event: we close the window
-      if (event->is<sf::Event::Closed>()) {
-        window.close();
-      }
-
-      if (auto e = event->getIf<sf::Event::KeyPressed>()) {
-        if (e->code == sf::Keyboard::Key::Escape) {
-          window.close();
-        }
-        if (e->code == sf::Keyboard::Key::R) {
-          reset_state();
-        }
-        if (e->code == sf::Keyboard::Key::Right) {
-          state.camera_position.x += 1.0f;
-        }
-        if (e->code == sf::Keyboard::Key::Left) {
-          state.camera_position.x -= 1.0f;
-        }
-        if (e->code == sf::Keyboard::Key::Down) {
-          state.camera_position.y += 1.0f;
-        }
-        if (e->code == sf::Keyboard::Key::Up) {
-          state.camera_position.y -= 1.0f;
-        }
-      }
-    }
+    poll_events(window);
     window.clear();
 
     auto delta_time = clock.restart();
     ImGui::SFML::Update(window, delta_time);
 
-    tick(std::min(delta_time.asSeconds(), 1.0f / 60.0f));
+    if (client) {
+      client_tick();
+    } else {
+      tick(delta_time.asSeconds());
+    }
     render(&window);
-    state.frame += 1;
+
+    const std::chrono::duration<float, std::milli> frame_time =
+        std::chrono::steady_clock::now() - frame_start;
+    state.perf.end_frame(frame_time.count(), state.entities.size());
   }
 
+  client.reset();
   ImGui::SFML::Shutdown();
 }
@@ -0,0 +1,435 @@
+#include <SFML/Network/Packet.hpp>
+#include <SFML/Network/UdpSocket.hpp>
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <easylogging++.h>
+INITIALIZE_EASYLOGGINGPP
+
+#include "perf.h"
+COUNT_ALLOCATIONS
+
+#include "counters.h"
+#include "datagram.h"
+#include "entity.h"
+#include "server.h"
+#include "simulation.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "world.h"
+
+// Headless benchmark of the balls simulation. Runs each workload once per
+// broadphase with a fixed step and seed and writes the results as JSON.
+//
+//   balls_bench [-n steps] [-o file] [-t trace file] [-c] [-u]
+//
+// -c also counts cycles, instructions and misses per phase where the kernel
+// lets us open hardware counters. -u measures loopback datagrams per second
+// instead of the simulation.
+
+namespace {
+
+constexpr float DELTA_TIME = 1.0f / 60.0f;
+
+struct Workload {
+  const char *name;
+  std::function<void()> setup;
+};
+
+// Little balls thrown around a walled box with heavy drag, settling into a
+// pile. Bodies barely move by the end, which is where temporal coherence pays.
+void settle(int count) {
+  reset_small(count, 1);
+
+  std::default_random_engine e(2);
+  std::uniform_real_distribution<float> vg(-200, 200);
+  for (Entity &b : state.entities) {
+    b.set_velocity({vg(e), vg(e)});
+  }
+
+  state.enable_gravity = false;
+  state.enable_walls = true;
+  state.enable_collisions = true;
+  state.drag = 0.02f;
+  state.elasticity = 0.5f;
+  state.solver = ContactSolver::Elastic;
+  state.solver_iterations = 1;
+  state.fidelity = {};
+}
+
+// The HighDrag example: little balls collapsing under their own gravity.
+void collapse(int count) {
+  reset_small(count, 1);
+
+  state.enable_gravity = true;
+  state.gravity = 1e2;
+  state.enable_walls = true;
+  state.enable_collisions = true;
+  state.drag = 0.02f;
+  state.elasticity = 1.0f;
+  state.solver = ContactSolver::Elastic;
+  state.solver_iterations = 1;
+  state.fidelity = {};
+}
+
+// A gravitational collapse into a dense pile, resolved by the impulse solver
+// with or without warm starting.
+void pile(bool warm_start) {
+  collapse(300);
+
+  state.solver = ContactSolver::Impulse;
+  state.solver_iterations = 4;
+  state.warm_start = warm_start;
+  state.elasticity = 0.2f;
+}
+
+// Many small balls and a few big ones, `ratio` times the radius.
+void mixed(float ratio) {
+  reset_state();
+
+  std::default_random_engine e(3);
+  std::uniform_real_distribution<float> pg(0, WORLD_WIDTH);
+  std::uniform_real_distribution<float> vg(-20, 20);
+  for (int i = 0; i < 3000; i++) {
+    const float size = i < 10 ? 2 * ratio : 2;
+    state.entities.emplace_back(
+        sf::Vector2f{pg(e), pg(e)}, sf::Vector2f{vg(e), vg(e)}, size, 1.0f,
+        sf::Color::White
+    );
+  }
+
+  state.enable_gravity = false;
+  state.enable_walls = true;
+  state.enable_collisions = true;
+  state.drag = 0.0f;
+  state.elasticity = 1.0f;
+  state.solver = ContactSolver::Elastic;
+  state.solver_iterations = 1;
+  state.fidelity = {};
+}
+
+// A bigger collapse with exact or tree gravity.
+void cluster(GravitySolver gravity) {
+  collapse(1000);
+  state.fidelity.gravity = gravity;
+}
+
+// The World snapshots a client would get of the workload, over a link that
+// takes LATENCY steps each way and loses nothing.
+class SnapshotLoop {
+public:
+  static constexpr uint32_t LATENCY = 3;
+
+  void step(uint32_t tick, std::span<const Entity> entities) {
+    m_bodies.resize(entities.size());
+    for (std::size_t i = 0; i < entities.size(); i++) {
+      m_bodies[i] = quantize(body_state(entities[i]), Quantization{});
+    }
+    std::sort(m_bodies.begin(), m_bodies.end(), [](auto &a, auto &b) {
+      return a.id < b.id;
+    });
+
+    std::span<const QuantizedBody> rest = m_bodies;
+    while (!rest.empty()) {
+      m_buffer.clear();
+      const std::size_t count =
+          m_encoder.encode(tick, rest, m_buffer, MAX_PAYLOAD - 1);
+      m_bytes += m_buffer.size() + 1;
+      m_sent += count;
+      m_to_client.push_back({tick + LATENCY, m_buffer});
+      rest = rest.subspan(count);
+    }
+
+    while (!m_to_client.empty() && m_to_client.front().first <= tick) {
+      m_decoder.decode(
+          m_to_client.front().second, [](auto &) {}, [](int32_t) {}
+      );
+      m_to_client.pop_front();
+    }
+    if (m_decoder.take_pending()) {
+      m_to_server.push_back(
+          {tick + LATENCY, {m_decoder.latest(), m_decoder.received()}}
+      );
+    }
+    while (!m_to_server.empty() && m_to_server.front().first <= tick) {
+      const Ack &ack = m_to_server.front().second;
+      m_encoder.ack(ack.sequence, ack.received);
+      m_to_server.pop_front();
+    }
+  }
+
+  float bytes_per_body() const {
+    return m_sent ? float(m_bytes) / m_sent : 0.0f;
+  }
+
+private:
+  SnapshotEncoder m_encoder{{}, 60};
+  SnapshotDecoder m_decoder{{}, 60};
+  std::vector<QuantizedBody> m_bodies;
+  bytes m_buffer;
+  std::deque<std::pair<uint32_t, bytes>> m_to_client;
+  std::deque<std::pair<uint32_t, Ack>> m_to_server;
+  uint64_t m_bytes = 0;
+  uint64_t m_sent = 0;
+};
+
+struct Throughput {
+  double datagrams_per_second = 0;
+  double allocations_per_datagram = 0;
+  double calls_per_datagram = 0;
+};
+
+constexpr int DATAGRAMS = 200000;
+constexpr std::size_t DATAGRAM_SIZE = 64; // about a small World snapshot
+
+// Loopback datagrams through DatagramSocket, a batch at a time.
+Throughput batched() {
+  DatagramSocket from, to;
+  if (!from.bind() || !to.bind()) {
+    return {};
+  }
+  const unsigned short port = to.local_port();
+
+  const uint64_t allocations = perf::allocations;
+  const auto start = std::chrono::steady_clock::now();
+  int received = 0;
+  for (int sent = 0; sent < DATAGRAMS;) {
+    for (std::size_t i = 0; i < DatagramSocket::BATCH && sent < DATAGRAMS;
+         i++, sent++) {
+      Datagram *d = from.buffer();
+      d->size = DATAGRAM_SIZE;
+      d->address = sf::IpAddress::LocalHost;
+      d->port = port;
+      from.send();
+    }
+    from.flush();
+    while (to.receive()) {
+      received++;
+    }
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  return {
+      received / elapsed.count(),
+      double(perf::allocations - allocations) / DATAGRAMS,
+      double(from.calls() + to.calls()) / DATAGRAMS
+  };
+}
+
+// The same through sf::UdpSocket, an sf::Packet per datagram.
+Throughput single() {
+  sf::UdpSocket from, to;
+  if (from.bind(sf::Socket::AnyPort) != sf::Socket::Status::Done ||
+      to.bind(sf::Socket::AnyPort) != sf::Socket::Status::Done) {
+    return {};
+  }
+  to.setBlocking(false);
+  const unsigned short port = to.getLocalPort();
+  const std::array<byte, DATAGRAM_SIZE> payload = {};
+
+  const uint64_t allocations = perf::allocations;
+  const auto start = std::chrono::steady_clock::now();
+  int received = 0;
+  uint64_t calls = 0;
+  for (int sent = 0; sent < DATAGRAMS;) {
+    for (std::size_t i = 0; i < DatagramSocket::BATCH && sent < DATAGRAMS;
+         i++, sent++) {
+      sf::Packet p;
+      p.append(payload.data(), payload.size());
+      from.send(p, sf::IpAddress::LocalHost, port);
+      calls++;
+    }
+    sf::Packet p;
+    std::optional<sf::IpAddress> address;
+    unsigned short from_port;
+    for (;;) {
+      calls++;
+      if (to.receive(p, address, from_port) != sf::Socket::Status::Done) {
+        break;
+      }
+      received++;
+    }
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  return {
+      received / elapsed.count(),
+      double(perf::allocations - allocations) / DATAGRAMS,
+      double(calls) / DATAGRAMS
+  };
+}
+
+void write_throughput(std::ostream &json, const char *path, Throughput t) {
+  std::fprintf(
+      stderr, "%-8s %10.0f datagrams/s %6.2f allocations %6.3f calls\n", path,
+      t.datagrams_per_second, t.allocations_per_datagram, t.calls_per_datagram
+  );
+  json << "  {\"path\": \"" << path
+       << "\", \"datagrams_per_second\": " << t.datagrams_per_second
+       << ", \"allocations_per_datagram\": " << t.allocations_per_datagram
+       << ", \"calls_per_datagram\": " << t.calls_per_datagram << "}";
+}
+
+// IPC and misses per body-step for every phase, or null if counting is off or
+// the counters couldn't be opened.
+void write_counters(std::ostream &json, const PerfHistory::Frame &total) {
+  if (!counters::enabled || !counters::available(counters::Cycles)) {
+    json << "null";
+    return;
+  }
+
+  json << "{";
+  for (std::size_t ph = 0; ph < PhaseTimes::PHASES; ph++) {
+    const Phase phase = static_cast<Phase>(ph);
+    json << (ph ? ", " : "") << "\"" << PHASE_NAMES[ph]
+         << "\": {\"ipc\": " << total.ipc(phase);
+    for (auto c : {counters::CacheMisses, counters::BranchMisses,
+                   counters::TlbMisses}) {
+      json << ", \"" << counters::NAMES[c] << "_per_body_step\": ";
+      if (counters::available(c)) {
+        json << total.per_body_step(phase, c);
+      } else {
+        json << "null";
+      }
+    }
+    json << "}";
+  }
+  json << "}";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  int steps = 600;
+  const char *out = "bench.json";
+  const char *trace_file = nullptr;
+  bool network = false;
+  for (int i = 1; i < argc; i++) {
+    if (!std::strcmp(argv[i], "-c")) {
+      counters::enabled = true;
+    } else if (!std::strcmp(argv[i], "-u")) {
+      network = true;
+    } else if (i + 1 == argc) {
+      break;
+    } else if (!std::strcmp(argv[i], "-n")) {
+      steps = std::atoi(argv[++i]);
+    } else if (!std::strcmp(argv[i], "-o")) {
+      out = argv[++i];
+    } else if (!std::strcmp(argv[i], "-t")) {
+      trace_file = argv[++i];
+    }
+  }
+
+  if (network) {
+    std::ofstream json(out);
+    json << "[\n";
+    write_throughput(json, "batched", batched());
+    json << ",\n";
+    write_throughput(json, "single", single());
+    json << "\n]\n";
+    return 0;
+  }
+
+  const std::vector<Workload> workloads = {
+      {"settle_500", [] { settle(500); }},
+      {"settle_1000", [] { settle(1000); }},
+      {"collapse_300", [] { collapse(300); }},
+      {"cluster_exact", [] { cluster(GravitySolver::Exact); }},
+      {"cluster_tree", [] { cluster(GravitySolver::Tree); }},
+      {"pile_cold", [] { pile(false); }},
+      {"pile_warm", [] { pile(true); }},
+      {"mixed_1x", [] { mixed(1); }},
+      {"mixed_10x", [] { mixed(10); }},
+      {"mixed_100x", [] { mixed(100); }},
+  };
+
+  // the diagnostics would only measure themselves, and the governor would
+  // change what is being measured
+  state.diagnostics.enabled = false;
+  state.governor.enabled = false;
+
+  std::ofstream json(out);
+  json << "[\n";
+  bool first = true;
+
+  for (const Workload &w : workloads) {
+    for (int b = 0; b < 3; b++) {
+      w.setup();
+      state.collisions.broadphase = static_cast<Broadphase>(b);
+
+      // every step is a frame, recorded the same way the balls app does
+      PerfHistory &perf = state.perf;
+      perf.resize(steps);
+      SnapshotLoop snapshots;
+      for (int i = 0; i < steps; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        simulate(DELTA_TIME);
+        const std::chrono::duration<float, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        perf.end_frame(elapsed.count(), state.entities.size());
+        snapshots.step(uint32_t(i), state.entities);
+      }
+
+      const CollisionPairs &c = state.collisions;
+      const Percentiles p = perf.percentiles(PerfHistory::FRAME);
+      const float ms_per_step = perf.mean(PerfHistory::FRAME);
+      std::fprintf(
+          stderr, "%-14s %-18s %8.3f ms/step\n", w.name, BROADPHASE_NAMES[b],
+          ms_per_step
+      );
+
+      json << (first ? "" : ",\n") << "  {\"workload\": \"" << w.name
+           << "\", \"broadphase\": \"" << BROADPHASE_NAMES[b]
+           << "\", \"bodies\": " << state.entities.size()
+           << ", \"steps\": " << steps << ", \"gravity\": \""
+           << GRAVITY_SOLVER_NAMES[static_cast<int>(state.fidelity.gravity)]
+           << "\", \"ms_per_step\": " << ms_per_step
+           << ", \"p50_ms\": " << p.p50 << ", \"p95_ms\": " << p.p95
+           << ", \"p99_ms\": " << p.p99 << ", \"max_ms\": " << p.max
+           << ", \"phase_ms\": {";
+      for (std::size_t ph = 0; ph < PhaseTimes::PHASES; ph++) {
+        json << (ph ? ", " : "") << "\"" << PHASE_NAMES[ph] << "\": "
+             << perf.mean(PerfHistory::phase(static_cast<Phase>(ph)));
+      }
+      json << "}, \"allocations_per_step\": "
+           << float(perf.total().allocations) / steps
+           << ", \"candidates_per_step\": " << c.candidates_per_step()
+           << ", \"contacts_per_step\": " << c.contacts_per_step()
+           << ", \"hit_rate\": " << c.hit_rate()
+           << ", \"rebuild_rate\": " << c.neighbours.rebuild_rate()
+           << ", \"solver_error\": " << state.solver_error
+           << ", \"warm_rate\": " << state.contact_cache.warm_rate()
+           << ", \"zones\": " << state.zones.zones()
+           << ", \"imbalance\": " << state.zones.imbalance()
+           << ", \"estimated_imbalance\": "
+           << state.zones.estimated_imbalance()
+           << ", \"snapshot_bytes_per_body\": " << snapshots.bytes_per_body()
+           << ", \"counters\": ";
+      write_counters(json, perf.total());
+      json << "}";
+      first = false;
+    }
+  }
+
+  json << "\n]\n";
+
+  // only the last steps fit in the trace buffers
+  if (trace_file && !trace::save(trace_file)) {
+    std::fprintf(stderr, "couldn't write a trace, is TRACE off?\n");
+  }
+  return 0;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include "neighbours.h"
+#include "pairs.h"
+#include "sweep.h"
+
+// Where collision candidates come from.
+enum class Broadphase
+{
+  // Verlet list built with a uniform grid fitted to the largest body
+  Grid,
+  // Verlet list built with a hierarchical grid, for mixed body sizes
+  HierarchicalGrid,
+  // incremental sweep and prune, for slow, settling scenes
+  SweepAndPrune,
+};
+
+inline constexpr const char *BROADPHASE_NAMES[] = {
+    "Grid", "Hierarchical Grid", "Sweep and Prune"
+};
+
+// Candidate collision pairs from the selected broadphase, with the metrics
+// shared by all of them.
+class CollisionPairs {
+public:
+  Broadphase broadphase = Broadphase::HierarchicalGrid;
+  NeighbourList neighbours;
+  SweepAndPrune sweep;
+
+  template <typename T> void update(std::span<T> bodies) {
+    switch (broadphase) {
+    case Broadphase::Grid:
+    case Broadphase::HierarchicalGrid:
+      neighbours.hierarchical = broadphase == Broadphase::HierarchicalGrid;
+      neighbours.update(bodies);
+      break;
+    case Broadphase::SweepAndPrune:
+      sweep.update(bodies);
+      break;
+    }
+  }
+
+  template <typename T, typename F>
+  void for_each(std::span<T> bodies, F &&f) const {
+    if (broadphase == Broadphase::SweepAndPrune) {
+      sweep.for_each(bodies, f);
+    } else {
+      NeighbourPairs{neighbours.pairs()}.for_each(bodies, f);
+    }
+  }
+
+  std::size_t candidates() const {
+    return broadphase == Broadphase::SweepAndPrune ? sweep.pairs().size()
+                                                   : neighbours.candidates();
+  }
+
+  // Tells the broadphase how many of its candidates turned out to be contacts.
+  void record_contacts(std::size_t contacts) {
+    m_steps++;
+    m_contacts += contacts;
+    m_checked += candidates();
+  }
+
+  // fraction of checked candidates that were actually touching
+  float hit_rate() const {
+    return m_checked ? float(m_contacts) / m_checked : 0.0f;
+  }
+
+  float candidates_per_step() const {
+    return m_steps ? float(m_checked) / m_steps : 0.0f;
+  }
+
+  float contacts_per_step() const {
+    return m_steps ? float(m_contacts) / m_steps : 0.0f;
+  }
+
+  void invalidate() {
+    neighbours.invalidate();
+    sweep.invalidate();
+  }
+
+  void reset_metrics() {
+    neighbours.reset_metrics();
+    m_steps = m_contacts = m_checked = 0;
+  }
+
+private:
+  uint64_t m_steps = 0;
+  uint64_t m_contacts = 0;
+  uint64_t m_checked = 0;
+};
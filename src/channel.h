@@ -0,0 +1,431 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+
+#include "API.h"
+#include "datagram.h"
+
+// Two channels over one UDP socket. Every datagram starts with a
+// PacketHeader, so it acknowledges what the other end sent on the way, then
+// for the reliable channel a ReliableHeader, then the MessageID, missing from
+// a packet that only acks, and then the payload. Unreliable messages are
+// handed over as they come. Reliable ones are sent again in new packets, after
+// a timeout from the measured round trip, until a packet carrying them is
+// acknowledged, and are handed over in order. A lost reliable message holds
+// back only the reliable ones after it, never the unreliable stream.
+
+enum class Channel : uint8_t
+{
+  Unreliable = 0,
+  Reliable,
+  COUNT
+};
+
+inline constexpr const char *CHANNEL_NAMES[] = {"Unreliable", "Reliable"};
+
+// Session control has to arrive; state is better new than late.
+inline Channel channel_of(MessageID id) {
+  switch (id) {
+  case MessageID::Error:
+  case MessageID::Version:
+  case MessageID::StartSession:
+  case MessageID::EntityID:
+  case MessageID::QuitSession:
+    return Channel::Reliable;
+  default:
+    return Channel::Unreliable;
+  }
+}
+
+struct PacketHeader {
+  uint16_t sequence; // this packet's number
+  uint16_t ack;      // the newest packet number received from the other end
+  uint32_t ack_bits; // bit k set if ack - 1 - k was received too
+  Channel channel;
+};
+
+template <> struct Wire<PacketHeader> {
+  static constexpr auto fields = std::tuple{
+      &PacketHeader::sequence, &PacketHeader::ack, &PacketHeader::ack_bits,
+      &PacketHeader::channel
+  };
+};
+
+// reliable only, after the packet header
+struct ReliableHeader {
+  uint16_t message; // the message's number, for order
+};
+
+template <> struct Wire<ReliableHeader> {
+  static constexpr auto fields = std::tuple{&ReliableHeader::message};
+};
+
+inline constexpr std::size_t PACKET_HEADER = wire_size<PacketHeader>;
+inline constexpr std::size_t RELIABLE_HEADER = wire_size<ReliableHeader>;
+
+struct ChannelStats {
+  float rtt = 0;     // smoothed round trip, seconds, 0 until measured
+  float rtt_var = 0; // and how much it varies
+  uint64_t sent = 0; // packets
+  uint64_t acked = 0;
+  uint64_t lost = 0; // never acknowledged
+  uint64_t resent = 0;
+
+  float loss() const {
+    return acked + lost ? float(lost) / (acked + lost) : 0.0f;
+  }
+};
+
+// One end of a connection, with the other end at `address`:`port`.
+class Endpoint {
+public:
+  using Clock = std::chrono::steady_clock;
+  // reliable messages waiting to be acknowledged, or to be handed over
+  static constexpr std::size_t WINDOW = 32;
+  // packets remembered for acks
+  static constexpr std::size_t SENT = 256;
+  // how long an ack may wait for a packet to ride on
+  static constexpr std::chrono::milliseconds ACK_DELAY{20};
+  static constexpr std::chrono::milliseconds MIN_TIMEOUT{20};
+  static constexpr std::chrono::milliseconds MAX_TIMEOUT{1000};
+  static constexpr std::chrono::milliseconds FIRST_TIMEOUT{200};
+
+  Endpoint(sf::IpAddress address, unsigned short port)
+    : m_address(address), m_port(port) {
+  }
+
+  sf::IpAddress address() const {
+    return m_address;
+  }
+
+  unsigned short port() const {
+    return m_port;
+  }
+
+  // Queues a message on the socket, on its channel. A reliable one is kept
+  // to send again, and dropped with false if WINDOW are still unacknowledged.
+  bool send(
+      DatagramSocket &socket, MessageID id, std::span<const byte> payload = {},
+      Clock::time_point now = Clock::now()
+  ) {
+    if (payload.size() > MAX_PAYLOAD) {
+      return false;
+    }
+    if (channel_of(id) == Channel::Unreliable) {
+      packet(socket, Channel::Unreliable, 0, id, payload, now);
+      return true;
+    }
+
+    if (uint16_t(m_next_message - m_oldest_unacked) >= WINDOW) {
+      m_blocked++;
+      return false;
+    }
+    Pending &p = m_pending[m_next_message % WINDOW];
+    p.used = true;
+    p.number = m_next_message++;
+    p.id = id;
+    p.size = payload.size();
+    std::copy(payload.begin(), payload.end(), p.payload.begin());
+    p.timeout = timeout();
+    p.sent = now;
+    packet(socket, Channel::Reliable, p.number, id, payload, now);
+    return true;
+  }
+
+  // Reads a datagram from the other end, calling f(const Message &) for each
+  // message it can hand over, in order on the reliable channel.
+  template <typename F>
+  void receive(const Datagram &d, Clock::time_point now, F &&f) {
+    const auto data = d.bytes();
+    const auto header = View<PacketHeader>::of(data);
+    if (!header || header->get<&PacketHeader::channel>() >= Channel::COUNT) {
+      m_malformed++;
+      return;
+    }
+    const Channel channel = header->get<&PacketHeader::channel>();
+    std::size_t at = PACKET_HEADER;
+    uint16_t number = 0;
+    if (channel == Channel::Reliable) {
+      const auto reliable = View<ReliableHeader>::of(data.subspan(at));
+      if (!reliable || data.size() < at + RELIABLE_HEADER + 1) {
+        m_malformed++;
+        return;
+      }
+      number = reliable->get<&ReliableHeader::message>();
+      at += RELIABLE_HEADER;
+    }
+
+    received(header->get<&PacketHeader::sequence>());
+    acknowledged(
+        header->get<&PacketHeader::ack>(),
+        header->get<&PacketHeader::ack_bits>(), now
+    );
+    if (at == data.size()) {
+      return; // only acks, which aren't acknowledged themselves
+    }
+    m_ack_owed = true;
+    const Message m = {
+        MessageID(data[at]), data.subspan(at + 1), d.address, d.port
+    };
+
+    if (channel == Channel::Unreliable) {
+      f(m);
+      return;
+    }
+    const int16_t ahead = int16_t(number - m_expected);
+    if (ahead < 0 || ahead >= int16_t(WINDOW)) {
+      return; // had it already, or too far ahead to keep
+    }
+    if (ahead > 0) {
+      Pending &p = m_arrived[number % WINDOW];
+      p.used = true;
+      p.number = number;
+      p.id = m.id;
+      p.size = m.payload.size();
+      std::copy(m.payload.begin(), m.payload.end(), p.payload.begin());
+      return;
+    }
+    m_expected++;
+    f(m);
+    // and whatever was waiting on it
+    for (Pending *p = &m_arrived[m_expected % WINDOW];
+         p->used && p->number == m_expected;
+         p = &m_arrived[m_expected % WINDOW]) {
+      p->used = false;
+      m_expected++;
+      f(Message{p->id, {p->payload.data(), p->size}, d.address, d.port});
+    }
+  }
+
+  // Sends the reliable messages that have waited too long for an ack again,
+  // and an ack on its own if nothing else has carried it. Call it every
+  // tick or frame.
+  void update(DatagramSocket &socket, Clock::time_point now = Clock::now()) {
+    for (uint16_t n = m_oldest_unacked; n != m_next_message; n++) {
+      Pending &p = m_pending[n % WINDOW];
+      if (!p.used || now - p.sent < p.timeout) {
+        continue;
+      }
+      // backing off, in case it's the link that's gone
+      p.timeout = std::min<Clock::duration>(p.timeout * 2, MAX_TIMEOUT);
+      p.sent = now;
+      m_stats[int(Channel::Reliable)].resent++;
+      packet(
+          socket, Channel::Reliable, p.number, p.id, {p.payload.data(), p.size},
+          now
+      );
+    }
+    if (m_ack_owed && now - m_last_sent >= ACK_DELAY) {
+      packet(socket, Channel::Unreliable, 0, std::nullopt, {}, now);
+    }
+  }
+
+  const ChannelStats &stats(Channel c) const {
+    return m_stats[int(c)];
+  }
+
+  // reliable messages waiting for an ack
+  std::size_t unacknowledged() const {
+    return uint16_t(m_next_message - m_oldest_unacked);
+  }
+
+  uint64_t malformed() const {
+    return m_malformed;
+  }
+
+private:
+  struct Pending {
+    bool used = false;
+    uint16_t number = 0;
+    MessageID id = MessageID::Ok;
+    std::size_t size = 0;
+    std::array<byte, MAX_PAYLOAD> payload;
+    Clock::time_point sent;
+    Clock::duration timeout = {};
+  };
+
+  struct Sent {
+    bool used = false;
+    bool acked = false;
+    uint16_t sequence = 0;
+    Channel channel = Channel::Unreliable;
+    uint16_t number = 0; // reliable message carried
+    Clock::time_point time;
+  };
+
+  // retransmission timeout from the round trip, preferring the reliable
+  // channel's own measurement
+  Clock::duration timeout() const {
+    const ChannelStats &r = m_stats[int(Channel::Reliable)];
+    const ChannelStats &u = m_stats[int(Channel::Unreliable)];
+    const ChannelStats &s = r.rtt > 0 ? r : u;
+    if (s.rtt <= 0) {
+      return FIRST_TIMEOUT;
+    }
+    const auto t = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<float>(s.rtt + 4 * s.rtt_var)
+    );
+    return std::clamp<Clock::duration>(t, MIN_TIMEOUT, MAX_TIMEOUT);
+  }
+
+  void packet(
+      DatagramSocket &socket, Channel channel, uint16_t number,
+      std::optional<MessageID> id, std::span<const byte> payload,
+      Clock::time_point now
+  ) {
+    const uint16_t sequence = m_sequence++;
+    // a packet that only acks isn't waited on, or counted
+    if (id) {
+      Sent &s = m_sent[sequence % SENT];
+      if (s.used && !s.acked) {
+        m_stats[int(s.channel)].lost++; // never heard of
+      }
+      s = {true, false, sequence, channel, number, now};
+      m_stats[int(channel)].sent++;
+    }
+
+    Datagram *d = socket.buffer();
+    byte *out = d->data.data();
+    Serialise(PacketHeader{sequence, m_remote, m_remote_bits, channel}, out);
+    std::size_t size = PACKET_HEADER;
+    if (channel == Channel::Reliable) {
+      Serialise(ReliableHeader{number}, out + size);
+      size += RELIABLE_HEADER;
+    }
+    if (id) {
+      out[size++] = byte(*id);
+      std::memcpy(out + size, payload.data(), payload.size());
+      size += payload.size();
+    }
+    d->size = size;
+    d->address = m_address;
+    d->port = m_port;
+    socket.send();
+
+    m_ack_owed = false;
+    m_last_sent = now;
+  }
+
+  // Notes a packet from the other end in the ack bits.
+  void received(uint16_t sequence) {
+    if (!m_any) {
+      m_any = true;
+      m_remote = sequence;
+      return;
+    }
+    const int16_t ahead = int16_t(sequence - m_remote);
+    if (ahead > 0) {
+      m_remote_bits = ahead >= 32 ? 0 : m_remote_bits << ahead;
+      if (ahead <= 32) {
+        m_remote_bits |= 1u << (ahead - 1);
+      }
+      m_remote = sequence;
+    } else if (ahead < 0 && ahead >= -32) {
+      m_remote_bits |= 1u << (-ahead - 1);
+    }
+  }
+
+  void acknowledged(uint16_t ack, uint32_t bits, Clock::time_point now) {
+    acknowledge(ack, now);
+    for (uint16_t k = 0; k < 32; k++) {
+      if (bits & (1u << k)) {
+        acknowledge(uint16_t(ack - 1 - k), now);
+      }
+    }
+    // anything sent too long before the newest ack to be in its bits is lost
+    if (!m_acks_seen || int16_t(ack - m_newest_ack) > 0) {
+      m_acks_seen = true;
+      m_newest_ack = ack;
+    }
+    for (; int16_t(m_newest_ack - m_loss_cursor) > 32; m_loss_cursor++) {
+      Sent &s = m_sent[m_loss_cursor % SENT];
+      if (s.used && s.sequence == m_loss_cursor && !s.acked) {
+        s.used = false;
+        m_stats[int(s.channel)].lost++;
+      }
+    }
+    while (m_oldest_unacked != m_next_message &&
+           !m_pending[m_oldest_unacked % WINDOW].used) {
+      m_oldest_unacked++;
+    }
+  }
+
+  void acknowledge(uint16_t sequence, Clock::time_point now) {
+    Sent &s = m_sent[sequence % SENT];
+    if (!s.used || s.acked || s.sequence != sequence) {
+      return;
+    }
+    s.acked = true;
+    ChannelStats &c = m_stats[int(s.channel)];
+    c.acked++;
+    const float sample = std::chrono::duration<float>(now - s.time).count();
+    if (c.rtt <= 0) {
+      c.rtt = sample;
+      c.rtt_var = sample / 2;
+    } else {
+      c.rtt_var += 0.25f * (std::abs(sample - c.rtt) - c.rtt_var);
+      c.rtt += 0.125f * (sample - c.rtt);
+    }
+    if (s.channel == Channel::Reliable) {
+      Pending &p = m_pending[s.number % WINDOW];
+      if (p.used && p.number == s.number) {
+        p.used = false;
+      }
+    }
+  }
+
+  sf::IpAddress m_address;
+  unsigned short m_port;
+
+  uint16_t m_sequence = 0;
+  std::array<Sent, SENT> m_sent;
+  bool m_acks_seen = false;
+  uint16_t m_newest_ack = 0;
+  uint16_t m_loss_cursor = 0;
+
+  bool m_any = false;
+  uint16_t m_remote = 0;
+  uint32_t m_remote_bits = 0;
+  bool m_ack_owed = false;
+  Clock::time_point m_last_sent;
+
+  uint16_t m_next_message = 0;
+  uint16_t m_oldest_unacked = 0;
+  std::array<Pending, WINDOW> m_pending;
+  uint16_t m_expected = 0;
+  std::array<Pending, WINDOW> m_arrived;
+
+  std::array<ChannelStats, size_t(Channel::COUNT)> m_stats;
+  uint64_t m_blocked = 0;
+  uint64_t m_malformed = 0;
+};
+
+// Answers a datagram from an address there's no Endpoint for, without making
+// one: `id` alone on the unreliable channel, acknowledging their packet so a
+// reliable request isn't sent again.
+inline void
+reply_unconnected(DatagramSocket &socket, const Datagram &to, MessageID id) {
+  const auto header = View<PacketHeader>::of(to.bytes());
+  if (!header) {
+    return;
+  }
+  Datagram *d = socket.buffer();
+  Serialise(
+      PacketHeader{
+          0, header->get<&PacketHeader::sequence>(), 0, Channel::Unreliable
+      },
+      d->data.data()
+  );
+  d->data[PACKET_HEADER] = byte(id);
+  d->size = PACKET_HEADER + 1;
+  d->address = to.address;
+  d->port = to.port;
+  socket.send();
+}
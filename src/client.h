@@ -0,0 +1,324 @@
+#pragma once
+
+#include <SFML/Graphics/CircleShape.hpp>
+#include <SFML/Graphics/Color.hpp>
+#include <SFML/Graphics/RenderWindow.hpp>
+#include <SFML/System/Vector2.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <easylogging++.h>
+
+#include "API.h"
+#include "channel.h"
+#include "fragment.h"
+#include "interpolation.h"
+#include "snapshot.h"
+
+// The thin end of the balls protocol: starts a session, keeps it alive and
+// keeps the latest state of every body the server sent. Every World datagram
+// is acknowledged, so the server can send the next ones as differences. A
+// lost one only leaves its bodies a little older. Once told where the camera
+// is, only the bodies around it are sent. Bodies are drawn through a jitter
+// buffer, so they move smoothly between the server's sends. Session control
+// goes on the reliable channel, so it's asked for once.
+class Client {
+public:
+  using Clock = std::chrono::steady_clock;
+  static constexpr std::chrono::seconds KEEP_ALIVE{1};
+  // a moving camera is sent at most this often
+  static constexpr std::chrono::milliseconds CAMERA{50};
+
+  Client(sf::IpAddress address, unsigned short port)
+    : m_endpoint(address, port) {
+    if (!m_socket.bind()) {
+      LOG(ERROR) << "Failure to bind UDP port. Exiting...";
+      exit(-1);
+    }
+  }
+
+  // Says goodbye once, as there's no waiting for the ack; the session times
+  // out if it's lost.
+  ~Client() {
+    if (connected()) {
+      m_endpoint.send(m_socket, MessageID::QuitSession);
+    }
+  }
+
+  // Handles everything the server sent and keeps the session going. Call it
+  // every frame.
+  void poll(Clock::time_point now = Clock::now()) {
+    while (const Datagram *d = m_socket.receive()) {
+      if (d->address == m_endpoint.address() && d->port == m_endpoint.port()) {
+        m_bytes += d->size;
+        m_endpoint.receive(*d, now, [&](const Message &m) { handle(m, now); });
+      }
+    }
+    if (m_decoder.take_pending()) {
+      send(MessageID::Ack, Ack{m_decoder.latest(), m_decoder.received()});
+    }
+
+    if (now - m_rate_start >= std::chrono::seconds(1)) {
+      const std::chrono::duration<float> elapsed = now - m_rate_start;
+      m_rate = (m_bytes - m_rate_bytes) / elapsed.count();
+      m_rate_start = now;
+      m_rate_bytes = m_bytes;
+    }
+
+    if (!m_asked) {
+      send(MessageID::StartSession, Version{VERSION});
+      m_asked = true;
+      m_sent = now;
+    } else if (m_info && m_view &&
+               ((*m_view != m_view_sent && now - m_sent >= CAMERA) ||
+                now - m_sent >= KEEP_ALIVE)) {
+      // lost ones are made up for by the next, so it doubles as keep alive
+      send(MessageID::Camera, *m_view);
+      m_view_sent = *m_view;
+      m_sent = now;
+    } else if (m_info && now - m_sent >= KEEP_ALIVE) {
+      m_endpoint.send(m_socket, MessageID::Ok);
+      m_sent = now;
+    }
+    m_endpoint.update(m_socket, now);
+    m_socket.flush();
+  }
+
+  // The part of the world on screen, top left and size.
+  void look(sf::Vector2f position, sf::Vector2f size) {
+    m_view = Camera{position.x, position.y, size.x, size.y};
+  }
+
+  bool connected() const {
+    return m_info.has_value();
+  }
+
+  const std::optional<SessionInfo> &session() const {
+    return m_info;
+  }
+
+  // the newest state of every body, by id
+  const std::vector<BodyState> &bodies() const {
+    return m_bodies;
+  }
+
+  const JitterBuffer &buffer() const {
+    return m_buffer;
+  }
+
+  const Reassembler &reassembler() const {
+    return m_reassembler;
+  }
+
+  const Endpoint &endpoint() const {
+    return m_endpoint;
+  }
+
+  // newest tick seen
+  uint32_t tick() const {
+    return m_tick;
+  }
+
+  uint64_t bytes_received() const {
+    return m_bytes;
+  }
+
+  // over the last second or so
+  float bytes_per_second() const {
+    return m_rate;
+  }
+
+  // World bytes per body received
+  float bytes_per_body() const {
+    return m_world_bodies ? float(m_world_bytes) / m_world_bodies : 0.0f;
+  }
+
+  // Asks which body is at a point; held() says once the server answers.
+  void pick(sf::Vector2f at) {
+    send(MessageID::EntityID, Pick{at.x, at.y});
+  }
+
+  // the body picked last, if there was one there
+  std::optional<int32_t> held() const {
+    return m_held;
+  }
+
+  void release() {
+    m_held.reset();
+  }
+
+  void move(sf::Vector2f to) {
+    if (m_held) {
+      send(MessageID::UpdatePosition, Move{*m_held, to.x, to.y});
+    }
+  }
+
+  void draw(sf::RenderWindow *window, sf::Vector2f offset = {0, 0}) {
+    for (const BodyState &b : m_buffer.sample(Clock::now())) {
+      m_shape.setRadius(b.radius);
+      m_shape.setFillColor(sf::Color(b.color));
+      m_shape.setPosition(
+          sf::Vector2f{b.x - b.radius, b.y - b.radius} + offset
+      );
+      window->draw(m_shape);
+    }
+  }
+
+private:
+  template <typename T> void send(MessageID id, T data) {
+    m_endpoint.send(m_socket, id, Serialise(data));
+  }
+
+  void handle(const Message &m, Clock::time_point now) {
+    switch (m.id) {
+    case MessageID::StartSession:
+      if (const auto view = ParseMessage<SessionInfo>(m); view && !m_info) {
+        const SessionInfo info = view->value();
+        m_info = info;
+        m_quantization = {info.position_steps, info.velocity_steps};
+        m_decoder = SnapshotDecoder(m_quantization, info.tick_rate);
+        m_buffer = JitterBuffer(info.tick_rate, info.send_rate);
+        LOG(INFO) << "Session " << info.session << " started at "
+                  << info.tick_rate << " ticks per second";
+      }
+      break;
+
+    case MessageID::Error:
+      LOG(ERROR) << "Server refused the session, version "
+                 << int(VERSION.major) << "." << int(VERSION.minor);
+      break;
+
+    case MessageID::World:
+      world(m, now);
+      break;
+
+    case MessageID::Fragment:
+      if (const auto whole = m_reassembler.add(m.payload, now);
+          whole && whole->id != MessageID::Fragment) {
+        handle({whole->id, whole->message, m.address, m.port}, now);
+      }
+      break;
+
+    case MessageID::EntityID:
+      if (const auto picked = ParseMessage<Picked>(m)) {
+        if (const int32_t id = picked->get<&Picked::id>(); id >= 0) {
+          m_held = id;
+        } else {
+          m_held.reset();
+        }
+      }
+      break;
+
+    case MessageID::Ok:
+    case MessageID::Version:
+    case MessageID::UpdatePosition:
+    case MessageID::QuitSession:
+    case MessageID::Ack:
+    case MessageID::Camera:
+      break;
+    }
+  }
+
+  void world(const Message &m, Clock::time_point now) {
+    if (!m_info) {
+      return;
+    }
+    std::size_t count = 0;
+    const uint32_t tick = m_decoder.tick(m.payload);
+    auto body = [&](const QuantizedBody &q) {
+      count += update(dequantize(q, m_quantization), tick);
+    };
+    auto leave = [&](int32_t id) { drop(id, tick); };
+    const auto decoded = m_decoder.decode(m.payload, body, leave);
+    if (!decoded) {
+      return;
+    }
+    m_tick = std::max(m_tick, tick);
+    m_buffer.arrived(tick, now);
+    m_world_bytes += m.payload.size() + 1;
+    m_world_bodies += count;
+  }
+
+  std::vector<BodyState>::iterator find(int32_t id) {
+    return std::lower_bound(
+        m_bodies.begin(), m_bodies.end(), id,
+        [](const BodyState &a, int32_t id) { return a.id < id; }
+    );
+  }
+
+  // Keeps a body's state unless it's older than the one we have, or than
+  // when it left.
+  bool update(const BodyState &b, uint32_t tick) {
+    if (const auto left = m_left.find(b.id); left != m_left.end()) {
+      if (int32_t(tick - left->second) <= 0) {
+        return false;
+      }
+      m_left.erase(left);
+    }
+    // late ones still fill in between for the jitter buffer
+    m_buffer.add(b, tick);
+    auto it = find(b.id);
+    const std::size_t k = it - m_bodies.begin();
+    if (it == m_bodies.end() || it->id != b.id) {
+      m_bodies.insert(it, b);
+      m_updated.insert(m_updated.begin() + k, tick);
+    } else if (int32_t(tick - m_updated[k]) < 0) {
+      return false; // a late datagram, this body has moved on since
+    }
+    m_bodies[k] = b;
+    m_updated[k] = tick;
+    return true;
+  }
+
+  // Drops a body that's out of view, unless it came back after `tick`.
+  void drop(int32_t id, uint32_t tick) {
+    const auto it = find(id);
+    const std::size_t k = it - m_bodies.begin();
+    if (it != m_bodies.end() && it->id == id) {
+      if (int32_t(tick - m_updated[k]) <= 0) {
+        return;
+      }
+      m_bodies.erase(it);
+      m_updated.erase(m_updated.begin() + k);
+      m_buffer.remove(id);
+    }
+    const auto [left, added] = m_left.try_emplace(id, tick);
+    if (!added && int32_t(tick - left->second) > 0) {
+      left->second = tick;
+    }
+  }
+
+  DatagramSocket m_socket;
+  Endpoint m_endpoint;
+  bool m_asked = false;
+  std::optional<SessionInfo> m_info;
+  Clock::time_point m_sent;
+
+  Quantization m_quantization;
+  SnapshotDecoder m_decoder;
+  std::vector<BodyState> m_bodies;
+  std::vector<uint32_t> m_updated; // tick of each body's state
+  // when bodies out of view left, so a late datagram can't bring them back
+  std::unordered_map<int32_t, uint32_t> m_left;
+  std::optional<Camera> m_view;
+  Camera m_view_sent = {};
+  JitterBuffer m_buffer;
+  Reassembler m_reassembler;
+  uint32_t m_tick = 0;
+  uint64_t m_world_bytes = 0;
+  uint64_t m_world_bodies = 0;
+  uint64_t m_bytes = 0;
+  Clock::time_point m_rate_start = Clock::now();
+  uint64_t m_rate_bytes = 0;
+  float m_rate = 0;
+  std::optional<int32_t> m_held;
+
+  sf::CircleShape m_shape;
+};
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "jobs.h"
+#include "pairs.h"
+
+struct Contact {
+  uint32_t a;
+  uint32_t b;
+
+  // filled in by the impulse solver
+  uint64_t key = 0;             // body pair handle, see ContactCache::key
+  sf::Vector2f normal = {0, 0}; // from a to b
+  float mass = 0;               // effective mass along the normal
+  float target = 0;             // normal velocity the solver aims for
+  float impulse = 0;            // accumulated normal impulse
+};
+
+// This frame's contacts, coloured so that no two contacts of one colour share
+// a body. A colour can then be resolved in parallel without any locking, and
+// because its contacts are independent the result does not depend on how
+// they are split across threads.
+class ContactGraph {
+public:
+  // Colours past this many go into one last group that is resolved serially.
+  static constexpr uint32_t MAX_COLOURS = 64;
+  // Colours smaller than this aren't worth splitting into jobs.
+  static constexpr std::size_t PARALLEL_THRESHOLD = 256;
+
+  // Collects the candidate pairs that actually touch, then colours them.
+  template <typename T, typename P>
+  void gather(std::span<T> bodies, const P &candidates) {
+    m_found.clear();
+    candidates.for_each(bodies, [&](const T &a, const T &b) {
+      if (a.collides(b)) {
+        m_found.push_back(
+            {uint32_t(&a - bodies.data()), uint32_t(&b - bodies.data())}
+        );
+      }
+    });
+    colour(bodies.size());
+  }
+
+  // Colours contacts that were found elsewhere, in several batches, taking
+  // the batches in order.
+  void
+  gather(std::size_t bodies, std::span<const std::vector<Contact>> batches) {
+    m_found.clear();
+    for (const std::vector<Contact> &batch : batches) {
+      m_found.insert(m_found.end(), batch.begin(), batch.end());
+    }
+    colour(bodies);
+  }
+
+  std::size_t size() const {
+    return m_contacts.size();
+  }
+
+  // number of colour groups, including the serial overflow group
+  std::size_t colours() const {
+    return m_offsets.size() - 1;
+  }
+
+  std::span<const Contact> contacts() const {
+    return m_contacts;
+  }
+
+  std::span<const Contact> colour(std::size_t c) const {
+    return {
+        m_contacts.data() + m_offsets[c], m_contacts.data() + m_offsets[c + 1]
+    };
+  }
+
+  // Calls resolve(a, b), or resolve(contact, a, b), on every contact, one
+  // colour after another, repeated `iterations` times.
+  template <typename T, typename F>
+  void solve(
+      std::span<T> bodies, F &&resolve, int iterations = 1,
+      JobSystem &system = jobs()
+  ) {
+    for (int it = 0; it < iterations; it++) {
+      for (std::size_t c = 0; c < colours(); c++) {
+        const std::span<Contact> group = {
+            m_contacts.data() + m_offsets[c], m_contacts.data() + m_offsets[c + 1]
+        };
+        auto run = [&](std::size_t begin, std::size_t end, std::size_t) {
+          for (std::size_t k = begin; k < end; k++) {
+            Contact &ct = group[k];
+            if constexpr (std::invocable<F &, Contact &, T &, T &>) {
+              resolve(ct, bodies[ct.a], bodies[ct.b]);
+            } else {
+              resolve(bodies[ct.a], bodies[ct.b]);
+            }
+          }
+        };
+
+        const bool serial = c == MAX_COLOURS; // the overflow group
+        if (serial || group.size() < PARALLEL_THRESHOLD) {
+          run(0, group.size(), 0);
+        } else {
+          system.parallel_for(group.size(), run);
+        }
+      }
+    }
+  }
+
+private:
+  // Greedy colouring: each contact takes the lowest colour neither body has
+  // used yet. Contacts are then bucketed by colour, keeping gather order.
+  void colour(std::size_t bodies) {
+    m_used.assign(bodies, 0);
+    m_colour.resize(m_found.size());
+
+    uint32_t count = 0;
+    for (std::size_t k = 0; k < m_found.size(); k++) {
+      const Contact &c = m_found[k];
+      const uint64_t used = m_used[c.a] | m_used[c.b];
+      const uint32_t colour = std::countr_one(used);
+      if (colour < MAX_COLOURS) {
+        m_used[c.a] |= 1ull << colour;
+        m_used[c.b] |= 1ull << colour;
+      }
+      m_colour[k] = colour;
+      count = std::max(count, colour + 1);
+    }
+
+    m_offsets.assign(count + 1, 0);
+    for (uint32_t colour : m_colour) {
+      m_offsets[colour + 1]++;
+    }
+    for (std::size_t c = 1; c < m_offsets.size(); c++) {
+      m_offsets[c] += m_offsets[c - 1];
+    }
+
+    m_contacts.resize(m_found.size());
+    m_fill.assign(m_offsets.begin(), m_offsets.end() - 1);
+    for (std::size_t k = 0; k < m_found.size(); k++) {
+      m_contacts[m_fill[m_colour[k]]++] = m_found[k];
+    }
+  }
+
+  std::vector<Contact> m_found;    // gather order
+  std::vector<Contact> m_contacts; // grouped by colour
+  std::vector<uint32_t> m_offsets = {0};
+  std::vector<uint32_t> m_colour;
+  std::vector<uint64_t> m_used; // colours taken, per body
+  std::vector<uint32_t> m_fill;
+};
+
+// Accumulated impulses carried over from one frame to the next, keyed by body
+// pair, so a resting contact starts from last frame's answer instead of zero.
+// Lookups read last frame's sorted entries and stores build this frame's, so
+// a contact that stops touching is evicted simply by not being stored again.
+class ContactCache {
+public:
+  static uint64_t key(uint32_t id_a, uint32_t id_b) {
+    return (uint64_t(std::min(id_a, id_b)) << 32) | std::max(id_a, id_b);
+  }
+
+  // last frame's impulse for the pair, 0 if it wasn't touching. Safe to call
+  // from several threads.
+  float find(uint64_t key) const {
+    const auto it = std::lower_bound(
+        m_previous.begin(), m_previous.end(), Entry{key, 0}
+    );
+    return it != m_previous.end() && it->key == key ? it->impulse : 0.0f;
+  }
+
+  // Replaces the cache with this frame's contacts.
+  void store(std::span<const Contact> contacts) {
+    m_current.clear();
+    std::size_t warm = 0;
+    for (const Contact &c : contacts) {
+      warm += std::binary_search(
+          m_previous.begin(), m_previous.end(), Entry{c.key, 0}
+      );
+      m_current.push_back({c.key, c.impulse});
+    }
+    std::sort(m_current.begin(), m_current.end());
+    std::swap(m_previous, m_current);
+
+    m_warm = contacts.empty() ? 0.0f : float(warm) / contacts.size();
+  }
+
+  void clear() {
+    m_previous.clear();
+    m_warm = 0;
+  }
+
+  // fraction of last frame's contacts that were warm started
+  float warm_rate() const {
+    return m_warm;
+  }
+
+private:
+  struct Entry {
+    uint64_t key;
+    float impulse;
+
+    bool operator<(const Entry &o) const {
+      return key < o.key;
+    }
+  };
+
+  std::vector<Entry> m_previous; // sorted by key
+  std::vector<Entry> m_current;
+  float m_warm = 0;
+};
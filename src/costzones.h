@@ -0,0 +1,156 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Cost zones for splitting per-body work across threads. Bodies are ordered
+// along a Morton curve, so nearby bodies end up together, and the curve is
+// cut into contiguous zones of equal estimated cost. The estimate for a body
+// is the number of interactions it had last step.
+class CostZones {
+public:
+  template <typename T> void partition(std::span<T> bodies, std::size_t zones) {
+    const std::size_t n = bodies.size();
+    if (m_costs.size() != n) {
+      m_costs.assign(n, 1);
+    }
+
+    sf::Vector2f lo = {
+        std::numeric_limits<float>::max(), std::numeric_limits<float>::max()
+    };
+    sf::Vector2f hi = -lo;
+    for (const T &b : bodies) {
+      const sf::Vector2f c = b.center();
+      lo = {std::min(lo.x, c.x), std::min(lo.y, c.y)};
+      hi = {std::max(hi.x, c.x), std::max(hi.y, c.y)};
+    }
+    const sf::Vector2f scale = {
+        65535 / std::max(hi.x - lo.x, 1e-3f),
+        65535 / std::max(hi.y - lo.y, 1e-3f)
+    };
+
+    m_curve.resize(n);
+    for (uint32_t i = 0; i < n; i++) {
+      const sf::Vector2f c = bodies[i].center() - lo;
+      const uint32_t code =
+          morton(uint32_t(c.x * scale.x), uint32_t(c.y * scale.y));
+      m_curve[i] = {code, i};
+    }
+    std::sort(m_curve.begin(), m_curve.end());
+
+    m_order.resize(n);
+    uint64_t total = 0;
+    for (std::size_t k = 0; k < n; k++) {
+      m_order[k] = m_curve[k].second;
+      total += m_costs[m_order[k]];
+    }
+
+    // cut wherever the running cost passes the next multiple of total/zones
+    zones = std::max<std::size_t>(1, std::min(zones, n));
+    m_bounds.assign(1, 0);
+    uint64_t running = 0;
+    for (std::size_t k = 0; k < n && m_bounds.size() < zones; k++) {
+      running += m_costs[m_order[k]];
+      if (running * zones >= total * m_bounds.size()) {
+        m_bounds.push_back(k + 1);
+      }
+    }
+    m_bounds.resize(zones, n);
+    m_bounds.push_back(n);
+
+    m_estimated.assign(zones, 0);
+    for (std::size_t z = 0; z < zones; z++) {
+      for (uint32_t i : zone(z)) {
+        m_estimated[z] += m_costs[i];
+      }
+    }
+    m_time.assign(zones, 0);
+  }
+
+  // Forgets the split, for steps that don't use it.
+  void clear() {
+    m_bounds.clear();
+    m_estimated.clear();
+    m_time.clear();
+  }
+
+  std::size_t zones() const {
+    return m_bounds.empty() ? 0 : m_bounds.size() - 1;
+  }
+
+  // body indices of zone z, in curve order
+  std::span<const uint32_t> zone(std::size_t z) const {
+    return {m_order.data() + m_bounds[z], m_order.data() + m_bounds[z + 1]};
+  }
+
+  // zone z covers positions [bounds[z], bounds[z + 1]) of the curve
+  const std::vector<std::size_t> &bounds() const {
+    return m_bounds;
+  }
+
+  // Interactions body i had this step. Each zone only writes its own bodies.
+  uint32_t &cost(uint32_t i) {
+    return m_costs[i];
+  }
+
+  // Runs f(zone) and records how long it took.
+  template <typename F> void timed(std::size_t z, F &&f) {
+    const auto start = std::chrono::steady_clock::now();
+    f(zone(z));
+    m_time[z] = std::chrono::duration<float>(
+                    std::chrono::steady_clock::now() - start
+    )
+                    .count();
+  }
+
+  // slowest zone over the average zone, as measured; 1 is perfectly even
+  float imbalance() const {
+    return ratio(m_time);
+  }
+
+  // the same ratio for the estimated costs the split was made with
+  float estimated_imbalance() const {
+    return ratio(m_estimated);
+  }
+
+private:
+  // interleaves the bits of x and y
+  static uint32_t morton(uint32_t x, uint32_t y) {
+    auto spread = [](uint32_t v) {
+      v &= 0xFFFF;
+      v = (v | (v << 8)) & 0x00FF00FF;
+      v = (v | (v << 4)) & 0x0F0F0F0F;
+      v = (v | (v << 2)) & 0x33333333;
+      v = (v | (v << 1)) & 0x55555555;
+      return v;
+    };
+    return spread(x) | (spread(y) << 1);
+  }
+
+  template <typename V> static float ratio(const std::vector<V> &v) {
+    if (v.empty()) {
+      return 1;
+    }
+    double sum = 0;
+    double max = 0;
+    for (V x : v) {
+      sum += x;
+      max = std::max<double>(max, x);
+    }
+    return sum > 0 ? float(max * v.size() / sum) : 1.0f;
+  }
+
+  std::vector<std::pair<uint32_t, uint32_t>> m_curve; // (code, body)
+  std::vector<uint32_t> m_order;
+  std::vector<std::size_t> m_bounds;
+  std::vector<uint32_t> m_costs;
+  std::vector<uint64_t> m_estimated;
+  std::vector<float> m_time;
+};
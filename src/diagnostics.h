@@ -0,0 +1,196 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "asynclog.h"
+#include "jobs.h"
+#include "pairs.h"
+
+// Conserved quantities of the system, measured every few frames instead of
+// being summed in every step. The sums can go in a step's own job graph,
+// beside the force pass, which reads the bodies the same way. Nothing here
+// runs while it's disabled.
+class Diagnostics {
+public:
+  struct Sample {
+    uint64_t frame = 0;
+    float kinetic = 0;
+    float potential = 0; // gravitational, negative
+    sf::Vector2f momentum = {0, 0};
+    float angular_momentum = 0; // about the centre of mass
+    sf::Vector2f center_of_mass = {0, 0};
+    float mass = 0;
+
+    float energy() const {
+      return kinetic + potential;
+    }
+
+    // 2K / |U|, 1 for a system in virial equilibrium
+    float virial_ratio() const {
+      return potential != 0 ? 2 * kinetic / std::abs(potential) : 0.0f;
+    }
+  };
+
+  bool enabled = true;
+  int sample_every = 30; // frames
+  bool only_when_visible = false;
+  bool visible = true; // set by whoever draws the panel
+  float drift_threshold = 0.01f; // relative energy error
+
+  bool due(uint64_t frame) const {
+    return enabled && (visible || !only_when_visible) &&
+           (!m_reference || frame % std::max(sample_every, 1) == 0);
+  }
+
+  // the jobs measure() adds, for what moves the bodies to wait on
+  struct Sums {
+    JobGraph::Job *bodies = nullptr;
+    JobGraph::Job *pairs = nullptr;
+  };
+
+  // Adds the per-body sums and the pair potential to `graph`, as two jobs
+  // with a partial per chunk. Anything in the graph that moves the bodies
+  // has to wait for both; finish() adds them up once it has run. Gravity 0
+  // skips the potential.
+  template <typename T>
+  Sums measure(JobGraph &graph, std::span<T> bodies, float gravity) {
+    Sums sums;
+    sums.bodies = graph.parallel_for(
+        bodies.size(),
+        [this, bodies](std::size_t begin, std::size_t end, std::size_t chunk) {
+          Partial p;
+          for (std::size_t i = begin; i < end; i++) {
+            T &b = bodies[i];
+            const float m = b.mass();
+            const sf::Vector2f v = b.velocity();
+            p.kinetic += 0.5f * m * v.lengthSquared();
+            p.momentum += m * v;
+            p.moment += m * b.center().cross(v);
+            p.weighted += m * b.center();
+            p.mass += m;
+          }
+          m_bodies[chunk] = p;
+        }
+    );
+    m_bodies.assign(sums.bodies->chunks, {});
+
+    m_pairs.clear();
+    if (gravity != 0) {
+      sums.pairs = graph.parallel_for(
+          bodies.size(),
+          [this, bodies,
+           gravity](std::size_t begin, std::size_t end, std::size_t chunk) {
+            float u = 0;
+            AllPairs{}.for_each_in_rows(
+                bodies, begin, end,
+                [&](T &a, const T &b) {
+                  u -= 0.5f * gravity * a.mass() * b.mass() /
+                       (a.center() - b.center()).length();
+                }
+            );
+            m_pairs[chunk] = u;
+          }
+      );
+      m_pairs.assign(sums.pairs->chunks, 0);
+    }
+    return sums;
+  }
+
+  // Adds up the sums of the last measure(), as the sample for `frame`. The
+  // first one after a reset becomes the reference the drift is measured
+  // against.
+  void finish(uint64_t frame) {
+    Sample s = total();
+    s.frame = frame;
+    m_last = s;
+
+    if (!m_reference) {
+      m_reference = s;
+      ALOG(INFO, "Total Energy of System: {}", s.energy());
+    }
+
+    const bool alarm = drift() > drift_threshold;
+    if (alarm && !m_alarm) {
+      ALOG(WARNING, "Energy drifted by {}% at frame {}", 100 * drift(), frame);
+    }
+    m_alarm = alarm;
+  }
+
+  // Forgets the samples; the next one is the new reference.
+  void reset() {
+    m_last.reset();
+    m_reference.reset();
+    m_alarm = false;
+  }
+
+  const std::optional<Sample> &last() const {
+    return m_last;
+  }
+
+  const std::optional<Sample> &reference() const {
+    return m_reference;
+  }
+
+  // energy error relative to the reference
+  float drift() const {
+    if (!m_last || !m_reference || m_reference->energy() == 0) {
+      return 0;
+    }
+    return std::abs(m_last->energy() / m_reference->energy() - 1);
+  }
+
+  bool alarm() const {
+    return m_alarm;
+  }
+
+private:
+  struct Partial {
+    float kinetic = 0;
+    float potential = 0;
+    sf::Vector2f momentum = {0, 0};
+    float moment = 0; // sum of m r x v about the origin
+    sf::Vector2f weighted = {0, 0};
+    float mass = 0;
+  };
+
+  // the partials, added up in chunk order
+  Sample total() const {
+    Partial total;
+    for (const Partial &p : m_bodies) {
+      total.kinetic += p.kinetic;
+      total.momentum += p.momentum;
+      total.moment += p.moment;
+      total.weighted += p.weighted;
+      total.mass += p.mass;
+    }
+    for (float u : m_pairs) {
+      total.potential += u;
+    }
+
+    Sample s;
+    s.kinetic = total.kinetic;
+    s.potential = total.potential;
+    s.momentum = total.momentum;
+    s.mass = total.mass;
+    if (total.mass != 0) {
+      s.center_of_mass = total.weighted / total.mass;
+      // L about the centre of mass is L about the origin minus R x P
+      s.angular_momentum = total.moment - s.center_of_mass.cross(total.momentum);
+    }
+    return s;
+  }
+
+  std::optional<Sample> m_last;
+  std::optional<Sample> m_reference;
+  bool m_alarm = false;
+
+  std::vector<Partial> m_bodies;
+  std::vector<float> m_pairs;
+};
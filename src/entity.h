@@ -54,7 +54,7 @@ public:
     m_position += m_velocity * delta_time;
   }
 
-  float mass() {
+  float mass() const {
     return m_mass;
   }
 
@@ -74,6 +74,10 @@ public:
     return m_velocity;
   }
 
+  const sf::Vector2f &velocity() const {
+    return m_velocity;
+  }
+
   void set_velocity(sf::Vector2f velocity) {
     m_velocity = velocity;
   }
@@ -86,11 +90,11 @@ public:
     return 2 * m_shape.getRadius();
   }
 
-  int id() {
+  int id() const {
     return m_id;
   }
 
-  bool collides(const Entity &e) {
+  bool collides(const Entity &e) const {
     return (center() - e.center()).length() < radius() + e.radius();
   }
 
@@ -102,6 +106,10 @@ public:
     return m_shape;
   }
 
+  const sf::CircleShape &shape() const {
+    return m_shape;
+  }
+
 private:
   sf::Vector2f m_force;
   sf::Vector2f m_position;
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "API.h"
+
+// Messages too big for one datagram, sent as Fragment messages and put back
+// together at the other end. Each fragment's payload is a FragmentHeader and
+// then up to FRAGMENT_BYTES of the message. With a group of n, every n data
+// fragments are followed by one more, index count + g for the g-th group,
+// that's their XOR, so any one fragment lost from a group can be rebuilt.
+// It's a hook for forward error correction, the simplest kind.
+
+struct FragmentHeader {
+  uint16_t sequence; // the same for every fragment of a message
+  uint8_t index;     // which fragment this is
+  uint8_t count;     // how many fragments carry the message
+  uint8_t group;     // data fragments per parity fragment, 0 for none
+  MessageID id;      // the message's
+  uint32_t size;     // the whole message's length in bytes
+};
+
+template <> struct Wire<FragmentHeader> {
+  static constexpr auto fields = std::tuple{
+      &FragmentHeader::sequence, &FragmentHeader::index, &FragmentHeader::count,
+      &FragmentHeader::group,    &FragmentHeader::id,    &FragmentHeader::size
+  };
+};
+
+inline constexpr std::size_t FRAGMENT_HEADER = wire_size<FragmentHeader>;
+inline constexpr std::size_t FRAGMENT_BYTES = MAX_PAYLOAD - 1 - FRAGMENT_HEADER;
+inline constexpr std::size_t MAX_FRAGMENTS = 64;
+inline constexpr std::size_t MAX_MESSAGE = FRAGMENT_BYTES * MAX_FRAGMENTS;
+
+// data fragments a message of `size` bytes takes, one at least
+inline constexpr std::size_t fragments(std::size_t size) {
+  return std::max<std::size_t>((size + FRAGMENT_BYTES - 1) / FRAGMENT_BYTES, 1);
+}
+
+class Fragmenter {
+public:
+  // data fragments per parity fragment, 0 for no parity
+  uint8_t group = 0;
+
+  // Calls f(std::span<const byte>) with each Fragment payload of the
+  // message, and returns false without calling it if the message is too big.
+  template <typename F>
+  bool split(MessageID id, std::span<const byte> message, F &&f) {
+    if (message.size() > MAX_MESSAGE) {
+      return false;
+    }
+    const std::size_t count = fragments(message.size());
+    const uint16_t sequence = m_sequence++;
+
+    std::array<byte, FRAGMENT_BYTES> parity;
+    for (std::size_t i = 0; i < count; i++) {
+      const auto part = message.subspan(
+          i * FRAGMENT_BYTES,
+          std::min(FRAGMENT_BYTES, message.size() - i * FRAGMENT_BYTES)
+      );
+      write(sequence, i, count, id, message.size(), part);
+      f(std::span<const byte>(m_buffer));
+
+      if (!group) {
+        continue;
+      }
+      if (i % group == 0) {
+        parity.fill(0);
+      }
+      for (std::size_t b = 0; b < part.size(); b++) {
+        parity[b] ^= part[b];
+      }
+      if (i % group == group - 1u || i == count - 1) {
+        write(sequence, count + i / group, count, id, message.size(), parity);
+        f(std::span<const byte>(m_buffer));
+      }
+    }
+    return true;
+  }
+
+private:
+  void write(
+      uint16_t sequence, std::size_t index, std::size_t count, MessageID id,
+      std::size_t size, std::span<const byte> part
+  ) {
+    m_buffer.resize(FRAGMENT_HEADER + part.size());
+    Serialise(
+        FragmentHeader{
+            sequence, uint8_t(index), uint8_t(count), group, id,
+            uint32_t(size)
+        },
+        m_buffer.data()
+    );
+    std::copy(part.begin(), part.end(), m_buffer.begin() + FRAGMENT_HEADER);
+  }
+
+  uint16_t m_sequence = 0;
+  bytes m_buffer;
+};
+
+// Puts fragments back together. Memory is bounded: SLOTS messages at once,
+// each at most MAX_MESSAGE, all allocated up front. A message that hasn't
+// completed in TIMEOUT is dropped, and a new one takes the oldest slot if
+// they're all in use.
+class Reassembler {
+public:
+  using Clock = std::chrono::steady_clock;
+  static constexpr std::size_t SLOTS = 4;
+  static constexpr std::chrono::seconds TIMEOUT{1};
+
+  struct Complete {
+    MessageID id;
+    std::span<const byte> message; // good until the next add()
+  };
+
+  Reassembler() {
+    for (Slot &s : m_slots) {
+      s.data.resize(MAX_MESSAGE);
+      s.parity.resize(MAX_FRAGMENTS * FRAGMENT_BYTES);
+    }
+  }
+
+  // Takes a Fragment payload, and gives back its message if this was the
+  // last piece missing.
+  std::optional<Complete>
+  add(std::span<const byte> fragment, Clock::time_point now = Clock::now()) {
+    expire(now);
+    const auto header = View<FragmentHeader>::of(fragment);
+    if (!header) {
+      m_malformed++;
+      return std::nullopt;
+    }
+    const uint16_t sequence = header->get<&FragmentHeader::sequence>();
+    const std::size_t index = header->get<&FragmentHeader::index>();
+    const std::size_t count = header->get<&FragmentHeader::count>();
+    const std::size_t group = header->get<&FragmentHeader::group>();
+    const MessageID id = header->get<&FragmentHeader::id>();
+    const std::size_t size = header->get<&FragmentHeader::size>();
+    const auto part = fragment.subspan(FRAGMENT_HEADER);
+
+    const std::size_t groups = group ? (count + group - 1) / group : 0;
+    if (size > MAX_MESSAGE || count != fragments(size) ||
+        index >= count + groups || part.size() > FRAGMENT_BYTES ||
+        (index < count && part.size() != length(index, count, size))) {
+      m_malformed++;
+      return std::nullopt;
+    }
+
+    Slot &s = slot(sequence, now);
+    if (s.state == Slot::Done) {
+      return std::nullopt; // a fragment it didn't need
+    }
+    if (s.state == Slot::Free) {
+      s.state = Slot::Partial;
+      s.count = count;
+      s.group = group;
+      s.id = id;
+      s.size = size;
+      s.have = s.have_parity = 0;
+    } else if (s.count != count || s.group != group || s.id != id ||
+               s.size != size) {
+      m_malformed++; // disagrees with the fragments before it
+      return std::nullopt;
+    }
+
+    if (index < count) {
+      if (s.have & bit(index)) {
+        return std::nullopt;
+      }
+      std::copy(
+          part.begin(), part.end(), s.data.begin() + index * FRAGMENT_BYTES
+      );
+      s.have |= bit(index);
+    } else {
+      const std::size_t g = index - count;
+      if (s.have_parity & bit(g)) {
+        return std::nullopt;
+      }
+      std::fill_n(s.parity.begin() + g * FRAGMENT_BYTES, FRAGMENT_BYTES, 0);
+      std::copy(
+          part.begin(), part.end(), s.parity.begin() + g * FRAGMENT_BYTES
+      );
+      s.have_parity |= bit(g);
+    }
+    if (group) {
+      recover(s, (index < count ? index / group : index - count));
+    }
+
+    if (s.have != (count == MAX_FRAGMENTS ? ~0ull : bit(count) - 1)) {
+      return std::nullopt;
+    }
+    s.state = Slot::Done;
+    m_completed++;
+    return Complete{id, std::span<const byte>(s.data.data(), size)};
+  }
+
+  uint64_t completed() const {
+    return m_completed;
+  }
+
+  // partial messages dropped, for taking too long or being pushed out
+  uint64_t expired() const {
+    return m_expired;
+  }
+
+  // fragments rebuilt from parity
+  uint64_t recovered() const {
+    return m_recovered;
+  }
+
+  uint64_t malformed() const {
+    return m_malformed;
+  }
+
+private:
+  struct Slot {
+    // done ones are kept until they time out, so the fragments they didn't
+    // need don't start them again
+    enum State { Free, Partial, Done } state = Free;
+    uint16_t sequence = 0;
+    std::size_t count = 0;
+    std::size_t group = 0;
+    MessageID id = MessageID::Ok;
+    std::size_t size = 0;
+    Clock::time_point started;
+    uint64_t have = 0;        // a bit per data fragment
+    uint64_t have_parity = 0; // and per parity fragment
+    bytes data;
+    bytes parity;
+  };
+
+  static uint64_t bit(std::size_t i) {
+    return uint64_t(1) << i;
+  }
+
+  // bytes of the message in fragment i
+  static std::size_t
+  length(std::size_t i, std::size_t count, std::size_t size) {
+    return i + 1 < count ? FRAGMENT_BYTES : size - i * FRAGMENT_BYTES;
+  }
+
+  // The slot a message is in, or a free one for it: one that was free, or
+  // done, or else the oldest.
+  Slot &slot(uint16_t sequence, Clock::time_point now) {
+    Slot *best = nullptr;
+    auto rank = [](const Slot &s) { return s.state == Slot::Partial; };
+    for (Slot &s : m_slots) {
+      if (s.state != Slot::Free && s.sequence == sequence) {
+        return s;
+      }
+      if (!best || rank(s) < rank(*best) ||
+          (rank(s) == rank(*best) && s.started < best->started)) {
+        best = &s;
+      }
+    }
+    if (best->state == Slot::Partial) {
+      m_expired++;
+    }
+    best->state = Slot::Free;
+    best->sequence = sequence;
+    best->started = now;
+    return *best;
+  }
+
+  void expire(Clock::time_point now) {
+    for (Slot &s : m_slots) {
+      if (s.state != Slot::Free && now - s.started >= TIMEOUT) {
+        m_expired += s.state == Slot::Partial;
+        s.state = Slot::Free;
+      }
+    }
+  }
+
+  // Rebuilds the one data fragment group g is missing, if it has the rest
+  // and the parity.
+  void recover(Slot &s, std::size_t g) {
+    if (!(s.have_parity & bit(g))) {
+      return;
+    }
+    const std::size_t first = g * s.group;
+    const std::size_t last = std::min(first + s.group, s.count);
+    std::size_t missing = last;
+    for (std::size_t i = first; i < last; i++) {
+      if (!(s.have & bit(i))) {
+        if (missing != last) {
+          return; // more than one
+        }
+        missing = i;
+      }
+    }
+    if (missing == last) {
+      return;
+    }
+
+    byte *out = s.data.data() + missing * FRAGMENT_BYTES;
+    const byte *parity = s.parity.data() + g * FRAGMENT_BYTES;
+    const std::size_t n = length(missing, s.count, s.size);
+    std::copy_n(parity, n, out);
+    for (std::size_t i = first; i < last; i++) {
+      if (i == missing) {
+        continue;
+      }
+      const byte *in = s.data.data() + i * FRAGMENT_BYTES;
+      const std::size_t m = std::min(n, length(i, s.count, s.size));
+      for (std::size_t b = 0; b < m; b++) {
+        out[b] ^= in[b];
+      }
+    }
+    s.have |= bit(missing);
+    m_recovered++;
+  }
+
+  std::array<Slot, SLOTS> m_slots;
+  uint64_t m_completed = 0;
+  uint64_t m_expired = 0;
+  uint64_t m_recovered = 0;
+  uint64_t m_malformed = 0;
+};
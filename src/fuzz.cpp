@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <easylogging++.h>
+INITIALIZE_EASYLOGGINGPP
+
+#include "API.h"
+#include "channel.h"
+#include "fragment.h"
+#include "snapshot.h"
+
+// Feeds untrusted bytes through everything that reads the balls protocol:
+// the packet header and both channels, every message's wire layout, the
+// fragment reassembler and the snapshot decoder, the way the client does.
+// An input is a run of datagrams, each a 16 bit little endian length and
+// then that many bytes.
+//
+// Built with -DFUZZ=ON (clang only), it's a libFuzzer target:
+//
+//   balls_fuzz corpus/
+//
+// Otherwise it runs inputs itself: the files given, or else -n inputs made
+// by mutating valid datagrams, from seed -s.
+//
+//   balls_fuzz [-n inputs] [-s seed] [files...]
+
+namespace {
+
+// Reading any T and writing it back has to give the same bytes.
+template <typename T> void round_trip(std::span<const byte> data) {
+  const auto view = View<T>::of(data);
+  if (!view) {
+    return;
+  }
+  const auto again = Serialise(view->value());
+  if (!std::equal(again.begin(), again.end(), data.begin())) {
+    std::fprintf(stderr, "Wire<T> round trip changed the bytes\n");
+    std::abort();
+  }
+}
+
+void message(
+    const Message &m, Reassembler &reassembler, SnapshotDecoder &decoder
+) {
+  round_trip<Version>(m.payload);
+  round_trip<SessionInfo>(m.payload);
+  round_trip<Ack>(m.payload);
+  round_trip<Camera>(m.payload);
+  round_trip<Pick>(m.payload);
+  round_trip<Picked>(m.payload);
+  round_trip<Move>(m.payload);
+  round_trip<FragmentHeader>(m.payload);
+
+  switch (m.id) {
+  case MessageID::World:
+    decoder.decode(
+        m.payload, [](const QuantizedBody &) {}, [](int32_t) {}
+    );
+    break;
+
+  case MessageID::Fragment:
+    if (const auto whole = reassembler.add(m.payload);
+        whole && whole->id != MessageID::Fragment) {
+      message(
+          {whole->id, whole->message, m.address, m.port}, reassembler, decoder
+      );
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+void run(const uint8_t *data, std::size_t size) {
+  // the reassembler's buffers are too big to make for every input, so it's
+  // the one thing an input can leave behind for the next
+  static auto reassembler = std::make_unique<Reassembler>();
+  static auto datagram = std::make_unique<Datagram>();
+  const auto endpoint =
+      std::make_unique<Endpoint>(sf::IpAddress::LocalHost, DEFAULT_PORT);
+  SnapshotDecoder decoder;
+
+  const auto now = Endpoint::Clock::now();
+  std::span<const uint8_t> rest(data, size);
+  while (rest.size() >= 2) {
+    const std::size_t length = std::min<std::size_t>(
+        load_le<uint16_t>(rest.data()), rest.size() - 2
+    );
+    const std::size_t kept = std::min(length, Datagram::CAPACITY);
+    std::copy_n(rest.data() + 2, kept, datagram->data.begin());
+    datagram->size = kept;
+    datagram->address = sf::IpAddress::LocalHost;
+    datagram->port = DEFAULT_PORT;
+    rest = rest.subspan(2 + length);
+
+    round_trip<PacketHeader>(datagram->bytes());
+    endpoint->receive(*datagram, now, [&](const Message &m) {
+      message(m, *reassembler, decoder);
+    });
+  }
+}
+
+// Valid datagrams to start mutating from.
+std::vector<bytes> seeds() {
+  std::vector<bytes> seeds;
+  auto datagram = [&](MessageID id, std::span<const byte> payload,
+                      Channel channel, uint16_t sequence) {
+    bytes d(PACKET_HEADER);
+    Serialise(PacketHeader{sequence, 0, 0, channel}, d.data());
+    if (channel == Channel::Reliable) {
+      const auto number = Serialise(ReliableHeader{sequence});
+      d.insert(d.end(), number.begin(), number.end());
+    }
+    d.push_back(byte(id));
+    d.insert(d.end(), payload.begin(), payload.end());
+    seeds.push_back(d);
+  };
+
+  datagram(
+      MessageID::StartSession, Serialise(SessionInfo{1, 60, 20, 16, 4}),
+      Channel::Reliable, 0
+  );
+  datagram(MessageID::Version, Serialise(VERSION), Channel::Reliable, 1);
+  datagram(MessageID::EntityID, Serialise(Picked{7}), Channel::Reliable, 2);
+  datagram(MessageID::Ack, Serialise(Ack{3, 5}), Channel::Unreliable, 3);
+  datagram(
+      MessageID::Camera, Serialise(Camera{0, 0, 800, 600}),
+      Channel::Unreliable, 4
+  );
+
+  SnapshotEncoder encoder;
+  std::vector<QuantizedBody> bodies;
+  for (int32_t i = 0; i < 300; i++) {
+    bodies.push_back({i, i * 16, -i * 16, i, -i, 80, 0xff0000ffu});
+  }
+  bytes world;
+  encoder.encode(1, std::span(bodies).first(5), world, MAX_PAYLOAD - 1);
+  datagram(MessageID::World, world, Channel::Unreliable, 5);
+
+  encoder.encode(2, bodies, world, MAX_MESSAGE);
+  Fragmenter fragmenter;
+  fragmenter.group = 2;
+  uint16_t sequence = 6;
+  fragmenter.split(MessageID::World, world, [&](std::span<const byte> f) {
+    datagram(MessageID::Fragment, f, Channel::Unreliable, sequence++);
+  });
+  return seeds;
+}
+
+// A few datagrams from the seeds, with bytes flipped, cut or added.
+bytes mutate(const std::vector<bytes> &seeds, std::mt19937 &rng) {
+  bytes input;
+  const int datagrams = std::uniform_int_distribution<int>(1, 8)(rng);
+  for (int i = 0; i < datagrams; i++) {
+    bytes d = seeds[rng() % seeds.size()];
+    const int edits = std::uniform_int_distribution<int>(0, 4)(rng);
+    for (int e = 0; e < edits && !d.empty(); e++) {
+      const std::size_t at = rng() % d.size();
+      switch (rng() % 4) {
+      case 0:
+        d[at] ^= byte(1u << (rng() % 8));
+        break;
+      case 1:
+        d[at] = byte(rng());
+        break;
+      case 2:
+        d.resize(at);
+        break;
+      case 3:
+        d.insert(d.begin() + at, byte(rng()));
+        break;
+      }
+    }
+    input.push_back(byte(d.size()));
+    input.push_back(byte(d.size() >> 8));
+    input.insert(input.end(), d.begin(), d.end());
+  }
+  return input;
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, std::size_t size) {
+  run(data, size);
+  return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+int main(int argc, char **argv) {
+  el::Loggers::setLoggingLevel(el::Level::Warning);
+  long inputs = 100000;
+  unsigned seed = 1;
+  std::vector<const char *> files;
+  for (int i = 1; i < argc; i++) {
+    if (!std::strcmp(argv[i], "-n") && i + 1 < argc) {
+      inputs = std::atol(argv[++i]);
+    } else if (!std::strcmp(argv[i], "-s") && i + 1 < argc) {
+      seed = unsigned(std::atol(argv[++i]));
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+
+  if (!files.empty()) {
+    for (const char *file : files) {
+      std::ifstream in(file, std::ios::binary);
+      const bytes input(std::istreambuf_iterator<char>(in), {});
+      run(input.data(), input.size());
+    }
+    std::printf("%zu files\n", files.size());
+    return 0;
+  }
+
+  const std::vector<bytes> valid = seeds();
+  std::mt19937 rng(seed);
+  for (long i = 0; i < inputs; i++) {
+    const bytes input = mutate(valid, rng);
+    run(input.data(), input.size());
+  }
+  std::printf("%ld inputs\n", inputs);
+  return 0;
+}
+#endif
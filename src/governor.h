@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "counters.h"
+#include "trace.h"
+
+enum class GravitySolver
+{
+  // every pair, exactly
+  Exact,
+  // Barnes-Hut tree, opened according to theta
+  Tree,
+};
+
+inline constexpr const char *GRAVITY_SOLVER_NAMES[] = {"Exact", "Tree"};
+
+// How carefully a frame is simulated.
+struct Fidelity {
+  GravitySolver gravity = GravitySolver::Exact;
+  float theta = 0.5f;
+  int substeps = 1;
+
+  bool operator==(const Fidelity &) const = default;
+};
+
+// Parts of a step that are timed separately.
+enum class Phase
+{
+  Broadphase,
+  // building the gravity tree
+  Tree,
+  // gravity and contact tests, per body
+  Interactions,
+  // colouring and resolving contacts
+  Contacts,
+  Integrate,
+};
+
+inline constexpr const char *PHASE_NAMES[] = {
+    "Broadphase", "Tree", "Interactions", "Contacts", "Integrate"
+};
+
+// Time spent in each phase, summed over all threads and substeps, so a phase
+// split across four threads costs four times its wall time. Each timing is
+// also a trace zone, and counts hardware events too while counters::enabled.
+class PhaseTimes {
+public:
+  static constexpr std::size_t PHASES = 5;
+
+  template <typename F> void time(Phase phase, F &&f) {
+    TRACE_ZONE(PHASE_NAMES[std::size_t(phase)]);
+    counters::Values before, after;
+    const bool counting = counters::enabled && counters::read(before);
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    m_ns[std::size_t(phase)] += std::chrono::nanoseconds(
+                                    std::chrono::steady_clock::now() - start
+    )
+                                    .count();
+    if (counting && counters::read(after)) {
+      for (std::size_t c = 0; c < counters::COUNT; c++) {
+        m_counts[std::size_t(phase)][c] += after[c] - before[c];
+      }
+    }
+  }
+
+  float ms(Phase phase) const {
+    return m_ns[std::size_t(phase)] / 1e6f;
+  }
+
+  uint64_t count(Phase phase, counters::Counter counter) const {
+    return m_counts[std::size_t(phase)][counter];
+  }
+
+  void clear() {
+    for (auto &ns : m_ns) {
+      ns = 0;
+    }
+    for (auto &counts : m_counts) {
+      for (auto &count : counts) {
+        count = 0;
+      }
+    }
+  }
+
+private:
+  std::array<std::atomic<int64_t>, PHASES> m_ns = {};
+  std::array<std::array<std::atomic<uint64_t>, counters::COUNT>, PHASES>
+      m_counts = {};
+};
+
+// Picks the fidelity each frame so the simulation stays within its time
+// budget. The choices form a ladder from most to least accurate: exact
+// gravity with every substep, then fewer substeps, then the tree with a
+// growing theta. The governor steps down the ladder while the frame is over
+// budget and back up once there's headroom, waiting a little after each move
+// so the new choice can be measured.
+//
+// It's off unless asked for, as what it picks depends on how fast the machine
+// is, and the top of the ladder is the plain single exact step unless
+// max_substeps asks for more.
+class Governor {
+public:
+  bool enabled = false;
+  float budget = 8.0f;   // ms of simulation per frame
+  float headroom = 0.6f; // step back up below this share of the budget
+  int max_substeps = 1;
+  int settle = 30; // frames to wait after a change
+
+  // Takes the frame's simulation time and returns the fidelity for the next
+  // frame.
+  Fidelity update(float ms) {
+    build();
+    m_average = m_frames == 0 ? ms : m_average + 0.1f * (ms - m_average);
+    m_frames++;
+
+    if (m_frames >= settle) {
+      if (m_average > budget && m_level + 1 < m_ladder.size()) {
+        move(m_level + 1);
+      } else if (m_average < headroom * budget && m_level > 0) {
+        // don't go straight back to a level that was too slow, but try
+        // again now and then in case the scene got cheaper
+        const float above = m_cost[m_level - 1];
+        if (above < budget || m_frames > 10 * settle) {
+          move(m_level - 1);
+        }
+      }
+    }
+    return fidelity();
+  }
+
+  Fidelity fidelity() {
+    build();
+    return m_ladder[m_level];
+  }
+
+  std::size_t level() const {
+    return m_level;
+  }
+
+  std::size_t levels() {
+    build();
+    return m_ladder.size();
+  }
+
+  // smoothed simulation time per frame
+  float average() const {
+    return m_average;
+  }
+
+  // Starts again from the top, for a new scene.
+  void reset() {
+    m_level = 0;
+    m_frames = 0;
+    m_average = 0;
+    std::fill(m_cost.begin(), m_cost.end(), 0.0f);
+  }
+
+private:
+  void build() {
+    if (!m_ladder.empty() && m_built_for == max_substeps) {
+      return;
+    }
+    m_built_for = max_substeps;
+    m_ladder.clear();
+    for (int s = std::max(max_substeps, 1); s >= 1; s--) {
+      m_ladder.push_back({GravitySolver::Exact, 0.5f, s});
+    }
+    for (float theta : {0.3f, 0.5f, 0.7f, 1.0f}) {
+      m_ladder.push_back({GravitySolver::Tree, theta, 1});
+    }
+    m_cost.assign(m_ladder.size(), 0);
+    m_level = std::min(m_level, m_ladder.size() - 1);
+  }
+
+  void move(std::size_t level) {
+    m_cost[m_level] = m_average;
+    m_level = level;
+    m_frames = 0;
+  }
+
+  std::vector<Fidelity> m_ladder;
+  std::vector<float> m_cost; // last measured time at each level, 0 if unknown
+  int m_built_for = 0;
+  std::size_t m_level = 0;
+  int m_frames = 0;
+  float m_average = 0;
+};
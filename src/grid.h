@@ -0,0 +1,128 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+// Uniform grid over the bodies' centres, rebuilt from scratch with a counting
+// sort. With a cell at least as wide as the largest interaction distance,
+// every interacting pair sits in the same or an adjacent cell.
+class UniformGrid {
+public:
+  // cells per axis are capped, so a body flung far away grows the cells
+  // instead of the allocation
+  static constexpr uint32_t MAX_CELLS = 1024;
+
+  template <typename T> void build(std::span<T> bodies, float cell_size) {
+    sf::Vector2f lo = {
+        std::numeric_limits<float>::max(), std::numeric_limits<float>::max()
+    };
+    sf::Vector2f hi = -lo;
+    for (const T &b : bodies) {
+      const sf::Vector2f c = b.center();
+      lo = {std::min(lo.x, c.x), std::min(lo.y, c.y)};
+      hi = {std::max(hi.x, c.x), std::max(hi.y, c.y)};
+    }
+    if (bodies.empty()) {
+      lo = hi = {0, 0};
+    }
+
+    m_cell_size = std::max(
+        {cell_size, (hi.x - lo.x) / MAX_CELLS, (hi.y - lo.y) / MAX_CELLS,
+         std::numeric_limits<float>::min()}
+    );
+    m_origin = lo;
+    m_width = cell_of(hi.x - lo.x) + 1;
+    m_height = cell_of(hi.y - lo.y) + 1;
+
+    m_cell.resize(bodies.size());
+    m_start.assign(m_width * m_height + 1, 0);
+    for (std::size_t i = 0; i < bodies.size(); i++) {
+      const sf::Vector2f c = bodies[i].center() - m_origin;
+      m_cell[i] = cell_of(c.y) * m_width + cell_of(c.x);
+      m_start[m_cell[i] + 1]++;
+    }
+    for (std::size_t c = 1; c < m_start.size(); c++) {
+      m_start[c] += m_start[c - 1];
+    }
+
+    m_items.resize(bodies.size());
+    m_fill.assign(m_start.begin(), m_start.end() - 1);
+    for (uint32_t i = 0; i < bodies.size(); i++) {
+      m_items[m_fill[m_cell[i]]++] = i;
+    }
+  }
+
+  uint32_t width() const {
+    return m_width;
+  }
+
+  uint32_t height() const {
+    return m_height;
+  }
+
+  float cell_size() const {
+    return m_cell_size;
+  }
+
+  // body indices in cell (x, y), in ascending order
+  std::span<const uint32_t> cell(uint32_t x, uint32_t y) const {
+    const uint32_t c = y * m_width + x;
+    return {m_items.data() + m_start[c], m_items.data() + m_start[c + 1]};
+  }
+
+  // Calls f(i) for every body in the cells the rectangle [lo, hi] touches,
+  // which is every body centred inside it and some around it.
+  template <typename F>
+  void for_each_in(sf::Vector2f lo, sf::Vector2f hi, F &&f) const {
+    if (m_width == 0 || hi.x < lo.x || hi.y < lo.y) {
+      return;
+    }
+    // clamped to the grid first, so a rectangle far away can't overflow
+    const sf::Vector2f size = {
+        m_width * m_cell_size, m_height * m_cell_size
+    };
+    lo -= m_origin;
+    hi -= m_origin;
+    if (hi.x < 0 || hi.y < 0 || lo.x >= size.x || lo.y >= size.y) {
+      return;
+    }
+    const uint32_t x0 = cell_of(lo.x);
+    const uint32_t y0 = cell_of(lo.y);
+    const uint32_t x1 = std::min(cell_of(std::min(hi.x, size.x)), m_width - 1);
+    const uint32_t y1 =
+        std::min(cell_of(std::min(hi.y, size.y)), m_height - 1);
+    for (uint32_t y = y0; y <= y1; y++) {
+      for (uint32_t x = x0; x <= x1; x++) {
+        for (uint32_t i : cell(x, y)) {
+          f(i);
+        }
+      }
+    }
+  }
+
+  // grid cell of body i as of the last build
+  sf::Vector2u cell_of_body(uint32_t i) const {
+    return {m_cell[i] % m_width, m_cell[i] / m_width};
+  }
+
+private:
+  uint32_t cell_of(float d) const {
+    return static_cast<uint32_t>(std::max(0.0f, std::floor(d / m_cell_size)));
+  }
+
+  sf::Vector2f m_origin;
+  float m_cell_size = 1;
+  uint32_t m_width = 0;
+  uint32_t m_height = 0;
+
+  std::vector<uint32_t> m_cell;  // cell index per body
+  std::vector<uint32_t> m_start; // CSR offsets into m_items, per cell
+  std::vector<uint32_t> m_items; // body indices grouped by cell
+  std::vector<uint32_t> m_fill;
+};
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Hierarchical grid for bodies of very different sizes. Level l has cells
+// 2^l times the size of the smallest body, and each body is inserted only at
+// the first level whose cells fit it. Pairs on the same level come from the
+// usual 3x3 neighbourhood; a body also looks up the 3x3 neighbourhood of its
+// enclosing cell on every coarser level that holds anything, so each
+// cross-level pair is found once, from the smaller body's side.
+//
+// Cells are stored sparsely: bodies are sorted by (level, cell) key and an
+// open-addressed table maps each occupied cell to its run, so bodies far
+// outside the world cost nothing extra.
+class HierarchicalGrid {
+public:
+  static constexpr int LEVELS = 24;
+
+  // margin is added to every body's diameter, pairs closer than
+  // r_a + r_b + margin are guaranteed to be visited
+  template <typename T> void build(std::span<T> bodies, float margin) {
+    m_entries.clear();
+    m_occupied = 0;
+    m_table.clear();
+    if (bodies.empty()) {
+      return;
+    }
+
+    float smallest = bodies[0].radius();
+    for (const T &b : bodies) {
+      smallest = std::min(smallest, b.radius());
+    }
+    m_base = std::max(2 * smallest + margin, 1e-3f);
+
+    for (uint32_t i = 0; i < bodies.size(); i++) {
+      const float extent = 2 * bodies[i].radius() + margin;
+      int level = 0;
+      while (level < LEVELS - 1 && cell_size(level) < extent) {
+        level++;
+      }
+      m_occupied |= 1u << level;
+
+      const sf::Vector2f c = bodies[i].center();
+      m_entries.push_back(
+          {key(level, cell_of(c.x, level), cell_of(c.y, level)), i}
+      );
+    }
+
+    std::sort(m_entries.begin(), m_entries.end());
+
+    m_table.assign(std::bit_ceil(2 * m_entries.size()), Cell{EMPTY, 0, 0});
+    for (uint32_t i = 0; i < m_entries.size();) {
+      uint32_t end = i + 1;
+      while (end < m_entries.size() && m_entries[end].key == m_entries[i].key) {
+        end++;
+      }
+      std::size_t slot = hash(m_entries[i].key) & (m_table.size() - 1);
+      while (m_table[slot].key != EMPTY) {
+        slot = (slot + 1) & (m_table.size() - 1);
+      }
+      m_table[slot] = {m_entries[i].key, i, end};
+      i = end;
+    }
+  }
+
+  // Calls f(a, b) once for every candidate pair.
+  template <typename T, typename F>
+  void for_each(std::span<T> bodies, F &&f) const {
+    static constexpr int stencil[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+
+    for (auto run = m_entries.begin(); run != m_entries.end();) {
+      const auto end = std::find_if(run, m_entries.end(), [&](const Entry &e) {
+        return e.key != run->key;
+      });
+      const int level = level_of(run->key);
+      const int32_t x = cell_x(run->key);
+      const int32_t y = cell_y(run->key);
+
+      for (auto a = run; a != end; a++) {
+        for (auto b = a + 1; b != end; b++) {
+          f(bodies[a->index], bodies[b->index]);
+        }
+      }
+
+      for (const auto &[dx, dy] : stencil) {
+        for_each_in(key(level, x + dx, y + dy), [&](const Entry &n) {
+          for (auto a = run; a != end; a++) {
+            f(bodies[a->index], bodies[n.index]);
+          }
+        });
+      }
+
+      // coarser levels, via the cell enclosing this one
+      for (uint32_t above = m_occupied >> (level + 1); above;) {
+        const int up = std::countr_zero(above);
+        above &= above - 1;
+
+        const int coarse = level + 1 + up;
+        const int32_t cx = x >> (coarse - level);
+        const int32_t cy = y >> (coarse - level);
+        for (int32_t ny = cy - 1; ny <= cy + 1; ny++) {
+          for (int32_t nx = cx - 1; nx <= cx + 1; nx++) {
+            for_each_in(key(coarse, nx, ny), [&](const Entry &n) {
+              for (auto a = run; a != end; a++) {
+                f(bodies[a->index], bodies[n.index]);
+              }
+            });
+          }
+        }
+      }
+
+      run = end;
+    }
+  }
+
+  // bit l is set if level l holds any bodies
+  uint32_t occupied_levels() const {
+    return m_occupied;
+  }
+
+private:
+  struct Entry {
+    uint64_t key;
+    uint32_t index;
+
+    bool operator<(const Entry &o) const {
+      return key < o.key || (key == o.key && index < o.index);
+    }
+  };
+
+  float cell_size(int level) const {
+    return std::ldexp(m_base, level);
+  }
+
+  int32_t cell_of(float p, int level) const {
+    const float c = std::floor(p / cell_size(level));
+    return static_cast<int32_t>(std::clamp(c, -1e8f, 1e8f));
+  }
+
+  // level in the top bits, then the biased cell coordinates
+  static uint64_t key(int level, int32_t x, int32_t y) {
+    return (uint64_t(level) << 59) | (uint64_t(uint32_t(x) + BIAS) << 30) |
+           uint64_t(uint32_t(y) + BIAS);
+  }
+
+  static int level_of(uint64_t key) {
+    return int(key >> 59);
+  }
+
+  static int32_t cell_x(uint64_t key) {
+    return int32_t(uint32_t((key >> 30) & MASK) - BIAS);
+  }
+
+  static int32_t cell_y(uint64_t key) {
+    return int32_t(uint32_t(key & MASK) - BIAS);
+  }
+
+  static std::size_t hash(uint64_t key) {
+    return std::size_t((key * 0x9E3779B97F4A7C15ull) >> 32);
+  }
+
+  template <typename F> void for_each_in(uint64_t key, F &&f) const {
+    const std::size_t mask = m_table.size() - 1;
+    for (std::size_t slot = hash(key) & mask;; slot = (slot + 1) & mask) {
+      const Cell &c = m_table[slot];
+      if (c.key == key) {
+        for (uint32_t i = c.begin; i < c.end; i++) {
+          f(m_entries[i]);
+        }
+        return;
+      }
+      if (c.key == EMPTY) {
+        return;
+      }
+    }
+  }
+
+  // cell coordinates get 29 bits each
+  static constexpr uint32_t BIAS = 1u << 28;
+  static constexpr uint64_t MASK = (1u << 29) - 1;
+
+  // an occupied cell and its run in m_entries
+  struct Cell {
+    uint64_t key;
+    uint32_t begin;
+    uint32_t end;
+  };
+  // level 31 is never used
+  static constexpr uint64_t EMPTY = ~0ull;
+
+  float m_base = 1;
+  uint32_t m_occupied = 0;
+  std::vector<Entry> m_entries;
+  std::vector<Cell> m_table;
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "API.h"
+#include "grid.h"
+
+// Which bodies one client is sent: those near its camera. A body enters once
+// it's within ENTER of the view and leaves only once it's further than LEAVE
+// out, so one hovering at the edge doesn't enter and leave every tick.
+// Margins are from the body's edge, not its centre.
+class Interest {
+public:
+  static constexpr float ENTER = 32;
+  static constexpr float LEAVE = 128;
+
+  void look(const Camera &view) {
+    m_view = view;
+  }
+
+  const std::optional<Camera> &view() const {
+    return m_view;
+  }
+
+  // Picks this tick's bodies out of `bodies`, with `grid` built over them
+  // and `reach` the largest radius among them, calling enter(id) and
+  // leave(id) for the changes. Without a view, that's every body.
+  template <typename T, typename Enter, typename Leave>
+  void update(
+      std::span<const T> bodies, const UniformGrid &grid, float reach,
+      Enter &&enter, Leave &&leave
+  ) {
+    m_found.clear();
+    if (!m_view) {
+      for (uint32_t i = 0; i < bodies.size(); i++) {
+        m_found.push_back({bodies[i].id(), i});
+      }
+    } else {
+      const sf::Vector2f lo = {m_view->x, m_view->y};
+      const sf::Vector2f hi = lo + sf::Vector2f{m_view->width, m_view->height};
+      const sf::Vector2f margin = {LEAVE + reach, LEAVE + reach};
+      grid.for_each_in(lo - margin, hi + margin, [&](uint32_t i) {
+        const T &b = bodies[i];
+        const float m = (has(b.id()) ? LEAVE : ENTER) + b.radius();
+        const sf::Vector2f c = b.center();
+        if (c.x >= lo.x - m && c.y >= lo.y - m && c.x <= hi.x + m &&
+            c.y <= hi.y + m) {
+          m_found.push_back({b.id(), i});
+        }
+      });
+    }
+    std::sort(m_found.begin(), m_found.end());
+
+    // both sorted by id, so a merge finds who came and went
+    m_ids.swap(m_last);
+    m_ids.clear();
+    m_visible.clear();
+    auto last = m_last.begin();
+    for (const auto &[id, i] : m_found) {
+      for (; last != m_last.end() && *last < id; last++) {
+        leave(*last);
+      }
+      if (last != m_last.end() && *last == id) {
+        last++;
+      } else {
+        enter(id);
+      }
+      m_ids.push_back(id);
+      m_visible.push_back(i);
+    }
+    for (; last != m_last.end(); last++) {
+      leave(*last);
+    }
+  }
+
+  // indices of the bodies picked last update, by increasing id
+  std::span<const uint32_t> visible() const {
+    return m_visible;
+  }
+
+  // and their ids
+  std::span<const int32_t> ids() const {
+    return m_ids;
+  }
+
+private:
+  bool has(int32_t id) const {
+    return std::binary_search(m_ids.begin(), m_ids.end(), id);
+  }
+
+  std::optional<Camera> m_view;
+  std::vector<int32_t> m_ids; // sorted
+  std::vector<int32_t> m_last;
+  std::vector<uint32_t> m_visible;
+  std::vector<std::pair<int32_t, uint32_t>> m_found;
+};
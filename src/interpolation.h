@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "API.h"
+
+// Smooths the bodies a client is sent over the bodies it draws. World
+// datagrams come a few times a second, late, out of order or not at all, so
+// bodies are drawn a little in the past: far enough behind the
+// newest tick that there's usually a state on either side to interpolate
+// between. How far adapts to how jittery the arrivals are. A body with
+// nothing newer, because its datagram is late or the server left it out, is
+// carried on along its velocity for up to EXTRAPOLATE.
+class JitterBuffer {
+public:
+  using Clock = std::chrono::steady_clock;
+  // states kept per body
+  static constexpr std::size_t SAMPLES = 4;
+  static constexpr float EXTRAPOLATE = 0.25f; // seconds
+  // the delay is a send interval and this many times the jitter
+  static constexpr float JITTER = 3;
+  static constexpr float SMOOTHING = 0.05f;
+
+  JitterBuffer(uint32_t tick_rate = 60, uint32_t send_rate = 20)
+    : m_tick_rate(std::max(tick_rate, 1u)),
+      m_interval(1.0f / std::max(send_rate, 1u)), m_delay(m_interval) {
+  }
+
+  // A datagram of `tick` came in at `now`. Its lateness against the ones
+  // before it sets the delay.
+  void arrived(uint32_t tick, Clock::time_point now) {
+    // the server's clock less ours, which varies only with the network
+    const double offset = double(tick) / m_tick_rate - seconds(now);
+    if (!m_started) {
+      m_started = true;
+      m_offset = offset;
+    }
+    const double late = m_offset - offset;
+    m_offset += SMOOTHING * (offset - m_offset);
+    m_jitter += SMOOTHING * (float(std::abs(late)) - m_jitter);
+    // eased, so what's drawn doesn't jump
+    const float target = m_interval + JITTER * m_jitter;
+    m_delay += SMOOTHING * (target - m_delay);
+  }
+
+  // Keeps a state of a body, in tick order with the others.
+  void add(const BodyState &b, uint32_t tick) {
+    auto it = find(b.id);
+    if (it == m_tracks.end() || it->id != b.id) {
+      it = m_tracks.insert(it, Track{b.id});
+    }
+    Track &t = *it;
+    std::size_t k = t.count;
+    while (k > 0 && int32_t(tick - t.samples[k - 1].tick) < 0) {
+      k--;
+    }
+    if (k > 0 && t.samples[k - 1].tick == tick) {
+      return;
+    }
+    if (t.count == SAMPLES) {
+      if (k == 0) {
+        return; // older than all of them
+      }
+      // the oldest makes way
+      std::move(
+          t.samples.begin() + 1, t.samples.begin() + k, t.samples.begin()
+      );
+      k--;
+    } else {
+      std::move_backward(
+          t.samples.begin() + k, t.samples.begin() + t.count,
+          t.samples.begin() + t.count + 1
+      );
+      t.count++;
+    }
+    t.samples[k] = {tick, b};
+  }
+
+  void remove(int32_t id) {
+    const auto it = find(id);
+    if (it != m_tracks.end() && it->id == id) {
+      m_tracks.erase(it);
+    }
+  }
+
+  // Every body as it was `delay()` behind the server, by id.
+  const std::vector<BodyState> &sample(Clock::time_point now) {
+    m_sampled.clear();
+    m_extrapolated = 0;
+    if (!m_started) {
+      return m_sampled;
+    }
+    // never backwards, even while the delay grows
+    const double at = (seconds(now) + m_offset - m_delay) * m_tick_rate;
+    m_at = std::max(at, m_at);
+
+    for (const Track &t : m_tracks) {
+      const Sample *before = nullptr;
+      const Sample *after = nullptr;
+      for (std::size_t k = 0; k < t.count; k++) {
+        if (t.samples[k].tick <= m_at) {
+          before = &t.samples[k];
+        } else {
+          after = &t.samples[k];
+          break;
+        }
+      }
+
+      if (before && after) {
+        const float s = float(
+            (m_at - before->tick) / double(after->tick - before->tick)
+        );
+        BodyState b = after->state;
+        b.x = std::lerp(before->state.x, after->state.x, s);
+        b.y = std::lerp(before->state.y, after->state.y, s);
+        b.vx = std::lerp(before->state.vx, after->state.vx, s);
+        b.vy = std::lerp(before->state.vy, after->state.vy, s);
+        m_sampled.push_back(b);
+      } else if (before) {
+        const float ahead = std::min(
+            float((m_at - before->tick) / m_tick_rate), EXTRAPOLATE
+        );
+        BodyState b = before->state;
+        b.x += b.vx * ahead;
+        b.y += b.vy * ahead;
+        m_sampled.push_back(b);
+        m_extrapolated += ahead > 0;
+      } else {
+        m_sampled.push_back(after->state); // not here yet, but here
+      }
+    }
+    return m_sampled;
+  }
+
+  // how far behind the server bodies are drawn, in seconds
+  float delay() const {
+    return m_delay;
+  }
+
+  float jitter() const {
+    return m_jitter;
+  }
+
+  // bodies carried on past their newest state by the last sample()
+  std::size_t extrapolated() const {
+    return m_extrapolated;
+  }
+
+private:
+  struct Sample {
+    uint32_t tick;
+    BodyState state;
+  };
+
+  struct Track {
+    int32_t id;
+    std::array<Sample, SAMPLES> samples = {};
+    std::size_t count = 0;
+  };
+
+  std::vector<Track>::iterator find(int32_t id) {
+    return std::lower_bound(
+        m_tracks.begin(), m_tracks.end(), id,
+        [](const Track &t, int32_t id) { return t.id < id; }
+    );
+  }
+
+  static double seconds(Clock::time_point t) {
+    return std::chrono::duration<double>(t.time_since_epoch()).count();
+  }
+
+  double m_tick_rate;
+  float m_interval;
+  bool m_started = false;
+  double m_offset = 0;
+  float m_jitter = 0;
+  float m_delay;
+  double m_at = 0;
+
+  std::vector<Track> m_tracks; // by id
+  std::vector<BodyState> m_sampled;
+  std::size_t m_extrapolated = 0;
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "grid.h"
+#include "hgrid.h"
+#include "pairs.h"
+
+// Cached collision candidates (a Verlet list). Every pair closer than
+// r_a + r_b + skin is stored, and the list stays valid until some body has
+// moved more than half the skin since it was built: two bodies can then have
+// closed the gap by at most one skin between them.
+class NeighbourList {
+public:
+  float skin = 10.0f;
+  // build with the hierarchical grid, otherwise with a uniform grid fitted to
+  // the largest body
+  bool hierarchical = true;
+
+  // Rebuilds the list if it may have gone stale. Returns true if it did.
+  template <typename T> bool update(std::span<T> bodies) {
+    m_steps++;
+    if (!stale(bodies)) {
+      return false;
+    }
+    build(bodies);
+    return true;
+  }
+
+  void invalidate() {
+    m_reference.clear();
+  }
+
+  // Half list: each pair is stored once, in the row of its lower index.
+  const CSR &pairs() const {
+    return m_pairs;
+  }
+
+  std::size_t candidates() const {
+    return m_pairs.indices.size();
+  }
+
+  // fraction of steps that had to rebuild
+  float rebuild_rate() const {
+    return m_steps ? float(m_builds) / m_steps : 0.0f;
+  }
+
+  uint64_t builds() const {
+    return m_builds;
+  }
+
+  void reset_metrics() {
+    m_builds = m_steps = 0;
+  }
+
+private:
+  template <typename T> bool stale(std::span<T> bodies) const {
+    if (m_reference.size() != bodies.size() || m_built_skin != skin ||
+        m_built_hierarchical != hierarchical) {
+      return true;
+    }
+
+    const float limit = 0.25f * skin * skin;
+    for (std::size_t i = 0; i < bodies.size(); i++) {
+      if ((bodies[i].center() - m_reference[i]).lengthSquared() > limit) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  template <typename T> void build(std::span<T> bodies) {
+    m_builds++;
+    m_built_skin = skin;
+    m_built_hierarchical = hierarchical;
+
+    float widest = 0;
+    m_reference.resize(bodies.size());
+    for (std::size_t i = 0; i < bodies.size(); i++) {
+      m_reference[i] = bodies[i].center();
+      widest = std::max(widest, 2 * bodies[i].radius());
+    }
+
+    m_found.clear();
+    m_pairs.offsets.assign(bodies.size() + 1, 0);
+    auto add = [&](const T &a, const T &b) {
+      const float reach = a.radius() + b.radius() + skin;
+      if ((a.center() - b.center()).lengthSquared() < reach * reach) {
+        const uint32_t i = &a - bodies.data();
+        const uint32_t j = &b - bodies.data();
+        m_found.emplace_back(std::min(i, j), std::max(i, j));
+        m_pairs.offsets[std::min(i, j) + 1]++;
+      }
+    };
+
+    if (hierarchical) {
+      m_hgrid.build(bodies, skin);
+      for_each_pair(m_hgrid, bodies, add);
+    } else {
+      m_grid.build(bodies, widest + skin);
+      for_each_pair(CellPairs{m_grid}, bodies, add);
+    }
+
+    for (std::size_t i = 1; i < m_pairs.offsets.size(); i++) {
+      m_pairs.offsets[i] += m_pairs.offsets[i - 1];
+    }
+
+    m_pairs.indices.resize(m_found.size());
+    m_fill.assign(m_pairs.offsets.begin(), m_pairs.offsets.end() - 1);
+    for (const auto &[i, j] : m_found) {
+      m_pairs.indices[m_fill[i]++] = j;
+    }
+
+    // ascending rows walk the bodies in memory order
+    for (std::size_t i = 0; i < m_pairs.rows(); i++) {
+      std::sort(
+          m_pairs.indices.begin() + m_pairs.offsets[i],
+          m_pairs.indices.begin() + m_pairs.offsets[i + 1]
+      );
+    }
+  }
+
+  CSR m_pairs;
+  UniformGrid m_grid;
+  HierarchicalGrid m_hgrid;
+  std::vector<sf::Vector2f> m_reference; // centres at the last build
+  float m_built_skin = 0;
+  bool m_built_hierarchical = false;
+
+  std::vector<std::pair<uint32_t, uint32_t>> m_found;
+  std::vector<uint32_t> m_fill;
+
+  uint64_t m_steps = 0;
+  uint64_t m_builds = 0;
+};
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <concepts>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "grid.h"
+
+// Pair iteration. A traversal decides which pairs of bodies are visited and in
+// what order; the callable decides what happens to them. Both are template
+// parameters, so the pair body inlines into the traversal loop.
+
+// Called once per unordered pair, may modify both bodies.
+template <typename F, typename T>
+concept PairFunction = std::invocable<F &, T &, T &>;
+
+// Called once per ordered pair from a's side, may only modify a, so jobs that
+// each own a range of bodies can run their rows side by side.
+template <typename F, typename T>
+concept RowFunction = std::invocable<F &, T &, const T &>;
+
+namespace detail {
+template <typename T> struct PairProbe {
+  void operator()(T &, T &) const {
+  }
+  void operator()(T &, const T &) const {
+  }
+};
+} // namespace detail
+
+// for_each(bodies, f) visits every pair it covers exactly once.
+template <typename P, typename T>
+concept PairTraversal = requires(const P &p, std::span<T> v) {
+  p.for_each(v, detail::PairProbe<T>{});
+};
+
+// Traversals also have for_each_in_rows(bodies, begin, end, f), which visits
+// every ordered pair (a, b) they cover with a's index in [begin, end).
+
+// Compressed sparse row adjacency: the neighbours of i are
+// indices[offsets[i] .. offsets[i + 1]).
+struct CSR {
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> indices;
+
+  std::size_t rows() const {
+    return offsets.empty() ? 0 : offsets.size() - 1;
+  }
+
+  std::span<const uint32_t> row(std::size_t i) const {
+    return {indices.data() + offsets[i], indices.data() + offsets[i + 1]};
+  }
+};
+
+// Every pair of bodies. The upper half of the pair matrix is walked in square
+// tiles so that both sides of a tile stay in cache.
+struct AllPairs {
+  std::size_t tile = 64;
+
+  template <typename T, PairFunction<T> F>
+  void for_each(std::span<T> v, F &&f) const {
+    const std::size_t n = v.size();
+    for (std::size_t ti = 0; ti < n; ti += tile) {
+      const std::size_t ie = std::min(ti + tile, n);
+      for (std::size_t i = ti; i < ie; i++) {
+        for (std::size_t j = i + 1; j < ie; j++) {
+          f(v[i], v[j]);
+        }
+      }
+
+      for (std::size_t tj = ie; tj < n; tj += tile) {
+        const std::size_t je = std::min(tj + tile, n);
+        for (std::size_t i = ti; i < ie; i++) {
+          for (std::size_t j = tj; j < je; j++) {
+            f(v[i], v[j]);
+          }
+        }
+      }
+    }
+  }
+
+  template <typename T, RowFunction<T> F>
+  void for_each_in_rows(
+      std::span<T> v, std::size_t begin, std::size_t end, F &&f
+  ) const {
+    const std::size_t n = v.size();
+    for (std::size_t tj = 0; tj < n; tj += tile) {
+      const std::size_t je = std::min(tj + tile, n);
+      for (std::size_t i = begin; i < end; i++) {
+        for (std::size_t j = tj; j < je; j++) {
+          if (i != j) {
+            f(v[i], std::as_const(v[j]));
+          }
+        }
+      }
+    }
+  }
+
+  // A single row, for callers that visit bodies in their own order.
+  template <typename T, RowFunction<T> F>
+  void for_each_in_row(std::span<T> v, std::size_t i, F &&f) const {
+    for (std::size_t j = 0; j < v.size(); j++) {
+      if (i != j) {
+        f(v[i], std::as_const(v[j]));
+      }
+    }
+  }
+};
+
+// Pairs listed in a neighbour list. With a half list (each pair stored once,
+// under its lower index) for_each visits every pair once; for_each_in_rows
+// needs a full list to see both sides.
+struct NeighbourPairs {
+  const CSR &list;
+
+  template <typename T, PairFunction<T> F>
+  void for_each(std::span<T> v, F &&f) const {
+    for (std::size_t i = 0; i < list.rows(); i++) {
+      for (uint32_t j : list.row(i)) {
+        f(v[i], v[j]);
+      }
+    }
+  }
+
+  template <typename T, RowFunction<T> F>
+  void for_each_in_rows(
+      std::span<T> v, std::size_t begin, std::size_t end, F &&f
+  ) const {
+    for (std::size_t i = begin; i < end; i++) {
+      for (uint32_t j : list.row(i)) {
+        f(v[i], std::as_const(v[j]));
+      }
+    }
+  }
+};
+
+// Pairs of bodies in the same or adjacent cells of a uniform grid. Each cell
+// is paired with itself and four of its neighbours, so no pair of cells is
+// visited twice.
+struct CellPairs {
+  const UniformGrid &grid;
+
+  template <typename T, PairFunction<T> F>
+  void for_each(std::span<T> v, F &&f) const {
+    static constexpr int stencil[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+
+    for (uint32_t y = 0; y < grid.height(); y++) {
+      for (uint32_t x = 0; x < grid.width(); x++) {
+        const auto home = grid.cell(x, y);
+        if (home.empty()) {
+          continue;
+        }
+
+        for (std::size_t a = 0; a < home.size(); a++) {
+          for (std::size_t b = a + 1; b < home.size(); b++) {
+            f(v[home[a]], v[home[b]]);
+          }
+        }
+
+        for (const auto &[dx, dy] : stencil) {
+          const int64_t nx = int64_t(x) + dx;
+          const int64_t ny = int64_t(y) + dy;
+          if (nx < 0 || nx >= grid.width() || ny >= grid.height()) {
+            continue;
+          }
+          for (uint32_t i : home) {
+            for (uint32_t j : grid.cell(nx, ny)) {
+              f(v[i], v[j]);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  template <typename T, RowFunction<T> F>
+  void for_each_in_rows(
+      std::span<T> v, std::size_t begin, std::size_t end, F &&f
+  ) const {
+    for (std::size_t i = begin; i < end; i++) {
+      const sf::Vector2u c = grid.cell_of_body(i);
+      const uint32_t x0 = c.x > 0 ? c.x - 1 : 0;
+      const uint32_t y0 = c.y > 0 ? c.y - 1 : 0;
+      const uint32_t x1 = std::min(c.x + 1, grid.width() - 1);
+      const uint32_t y1 = std::min(c.y + 1, grid.height() - 1);
+      for (uint32_t y = y0; y <= y1; y++) {
+        for (uint32_t x = x0; x <= x1; x++) {
+          for (uint32_t j : grid.cell(x, y)) {
+            if (j != i) {
+              f(v[i], std::as_const(v[j]));
+            }
+          }
+        }
+      }
+    }
+  }
+};
+
+template <typename T, PairTraversal<T> P, PairFunction<T> F>
+void for_each_pair(const P &pairs, std::span<T> v, F &&f) {
+  pairs.for_each(v, f);
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "governor.h"
+
+// Performance history over the last few hundred frames. simulate() adds to
+// the frame in progress and the loop that owns the frames ends it, so the
+// balls performance panel and the benchmark read the same numbers.
+
+namespace perf {
+
+// every operator new since start, if COUNT_ALLOCATIONS is expanded somewhere
+inline std::atomic<uint64_t> allocations = 0;
+
+} // namespace perf
+
+// Counts allocations. Expand it once, at file scope, in the translation unit
+// with main(), like INITIALIZE_EASYLOGGINGPP.
+#define COUNT_ALLOCATIONS                                                      \
+  void *operator new(std::size_t size) {                                       \
+    perf::allocations.fetch_add(1, std::memory_order_relaxed);                 \
+    if (void *p = std::malloc(size ? size : 1)) {                              \
+      return p;                                                                \
+    }                                                                          \
+    throw std::bad_alloc();                                                    \
+  }                                                                            \
+  void operator delete(void *p) noexcept {                                     \
+    std::free(p);                                                              \
+  }                                                                            \
+  void operator delete(void *p, std::size_t) noexcept {                        \
+    std::free(p);                                                              \
+  }
+
+struct Percentiles {
+  float p50 = 0;
+  float p95 = 0;
+  float p99 = 0;
+  float max = 0;
+};
+
+class PerfHistory {
+public:
+  // values kept per frame: wall time and simulation time in ms, steps, then
+  // the ms spent in every phase
+  static constexpr std::size_t FRAME = 0;
+  static constexpr std::size_t SIMULATION = 1;
+  static constexpr std::size_t STEPS = 2;
+  static constexpr std::size_t SERIES = 3 + PhaseTimes::PHASES;
+
+  static constexpr std::size_t phase(Phase p) {
+    return 3 + std::size_t(p);
+  }
+
+  explicit PerfHistory(std::size_t capacity = 600) {
+    resize(capacity);
+  }
+
+  // Keeps the last `capacity` frames, dropping everything recorded so far.
+  void resize(std::size_t capacity) {
+    m_capacity = std::max<std::size_t>(capacity, 1);
+    for (auto &s : m_series) {
+      s.assign(m_capacity, 0);
+    }
+    clear();
+  }
+
+  void clear() {
+    m_next = m_size = 0;
+    m_frames = 0;
+    m_frame = {};
+    m_total = {};
+    m_allocations = perf::allocations;
+  }
+
+  // Adds one simulate() call to the frame in progress.
+  void step(
+      float ms, const PhaseTimes &phases, std::size_t candidates,
+      std::size_t contacts
+  ) {
+    m_frame.steps++;
+    m_frame.simulation += ms;
+    for (std::size_t p = 0; p < PhaseTimes::PHASES; p++) {
+      m_frame.phases[p] += phases.ms(static_cast<Phase>(p));
+      for (std::size_t c = 0; c < counters::COUNT; c++) {
+        m_frame.counts[p][c] +=
+            phases.count(static_cast<Phase>(p), counters::Counter(c));
+      }
+    }
+    m_frame.candidates += candidates;
+    m_frame.contacts += contacts;
+  }
+
+  // Closes the frame in progress, which took `ms` of wall time in all.
+  void end_frame(float ms, std::size_t bodies) {
+    const uint64_t allocations = perf::allocations;
+
+    m_series[FRAME][m_next] = ms;
+    m_series[SIMULATION][m_next] = m_frame.simulation;
+    m_series[STEPS][m_next] = float(m_frame.steps);
+    for (std::size_t p = 0; p < PhaseTimes::PHASES; p++) {
+      m_series[phase(static_cast<Phase>(p))][m_next] = m_frame.phases[p];
+    }
+    m_next = (m_next + 1) % m_capacity;
+    m_size = std::min(m_size + 1, m_capacity);
+
+    m_last = m_frame;
+    m_last.wall = ms;
+    m_last.bodies = bodies;
+    m_last.allocations = allocations - m_allocations;
+    m_last.body_steps = bodies * m_last.steps;
+    m_allocations = allocations;
+
+    m_total.steps += m_last.steps;
+    for (std::size_t p = 0; p < PhaseTimes::PHASES; p++) {
+      m_total.phases[p] += m_last.phases[p];
+      for (std::size_t c = 0; c < counters::COUNT; c++) {
+        m_total.counts[p][c] += m_last.counts[p][c];
+      }
+    }
+    m_total.wall += ms;
+    m_total.candidates += m_last.candidates;
+    m_total.contacts += m_last.contacts;
+    m_total.allocations += m_last.allocations;
+    m_total.body_steps += m_last.body_steps;
+    m_frames++;
+    m_frame = {};
+  }
+
+  std::size_t size() const {
+    return m_size;
+  }
+
+  std::size_t capacity() const {
+    return m_capacity;
+  }
+
+  // The series as a ring buffer, e.g. for ImGui::PlotLines: `capacity()`
+  // values, the oldest at `offset()`. Frames not recorded yet are 0.
+  const float *data(std::size_t series) const {
+    return m_series[series].data();
+  }
+
+  std::size_t offset() const {
+    return m_size < m_capacity ? 0 : m_next;
+  }
+
+  Percentiles percentiles(std::size_t series) const {
+    m_sorted.assign(m_series[series].begin(), m_series[series].end());
+    m_sorted.resize(m_size);
+    if (m_sorted.empty()) {
+      return {};
+    }
+    std::sort(m_sorted.begin(), m_sorted.end());
+    auto at = [&](float q) {
+      const std::size_t k = std::size_t(q * m_sorted.size());
+      return m_sorted[std::min(k, m_sorted.size() - 1)];
+    };
+    return {at(0.5f), at(0.95f), at(0.99f), m_sorted.back()};
+  }
+
+  // over the frames in the window
+  float sum(std::size_t series) const {
+    float sum = 0;
+    for (std::size_t k = 0; k < m_size; k++) {
+      sum += m_series[series][k];
+    }
+    return sum;
+  }
+
+  float mean(std::size_t series) const {
+    return m_size ? sum(series) / m_size : 0.0f;
+  }
+
+  struct Frame {
+    uint64_t steps = 0;
+    float simulation = 0;
+    std::array<float, PhaseTimes::PHASES> phases = {};
+    // hardware counts per phase, all 0 unless counters::enabled
+    std::array<counters::Values, PhaseTimes::PHASES> counts = {};
+    uint64_t candidates = 0;
+    uint64_t contacts = 0;
+    float wall = 0;
+    std::size_t bodies = 0;
+    uint64_t allocations = 0;
+    uint64_t body_steps = 0; // bodies times steps
+
+    // instructions per cycle in a phase
+    double ipc(Phase phase) const {
+      const auto &c = counts[std::size_t(phase)];
+      return c[counters::Cycles]
+                 ? double(c[counters::Instructions]) / c[counters::Cycles]
+                 : 0.0;
+    }
+
+    // events of one kind in a phase for every body in every step
+    double per_body_step(Phase phase, counters::Counter counter) const {
+      return body_steps
+                 ? double(counts[std::size_t(phase)][counter]) / body_steps
+                 : 0.0;
+    }
+  };
+
+  // the last complete frame
+  const Frame &last() const {
+    return m_last;
+  }
+
+  // Everything since the last clear(), summed.
+  const Frame &total() const {
+    return m_total;
+  }
+
+  // frames since the last clear()
+  uint64_t frames() const {
+    return m_frames;
+  }
+
+private:
+  std::size_t m_capacity = 0;
+  std::array<std::vector<float>, SERIES> m_series;
+  std::size_t m_next = 0;
+  std::size_t m_size = 0;
+  mutable std::vector<float> m_sorted;
+
+  Frame m_frame; // in progress
+  Frame m_last;
+  Frame m_total;
+  uint64_t m_frames = 0;
+  uint64_t m_allocations = 0;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "API.h"
+
+// How overdue each body one client can see is for an update. Every tick a
+// body goes unsent its priority grows by its score, and sending it resets it,
+// so with too little bandwidth for everything the fast, big and near bodies
+// are sent often and the slow, small and far ones now and then, but all of
+// them eventually.
+class PriorityAccumulator {
+public:
+  // a body this fast or this big scores double, and one this far from the
+  // camera's centre half
+  static constexpr float SPEED = 50;
+  static constexpr float SIZE = 20;
+  static constexpr float DISTANCE = 250;
+  // what a body that just came into view starts at, so it's drawn soon
+  static constexpr float ENTERED = 1000;
+
+  static float score(const BodyState &b, const std::optional<Camera> &view) {
+    const float speed = sf::Vector2f{b.vx, b.vy}.length();
+    float distance = 0;
+    if (view) {
+      const sf::Vector2f centre = {
+          view->x + view->width / 2, view->y + view->height / 2
+      };
+      distance = (sf::Vector2f{b.x, b.y} - centre).length();
+    }
+    return (1 + speed / SPEED) * (1 + b.radius / SIZE) /
+           (1 + distance / DISTANCE);
+  }
+
+  // Takes this tick's bodies, by increasing id, and adds score(k) to the
+  // k-th one's priority. Bodies no longer there are forgotten.
+  template <typename F>
+  void accumulate(std::span<const int32_t> ids, F &&score) {
+    m_ids.swap(m_last_ids);
+    m_priority.swap(m_last_priority);
+    m_ids.assign(ids.begin(), ids.end());
+    m_priority.resize(ids.size());
+
+    // both sorted by id, so bodies keep their priority with a merge
+    std::size_t last = 0;
+    for (std::size_t k = 0; k < ids.size(); k++) {
+      while (last < m_last_ids.size() && m_last_ids[last] < ids[k]) {
+        last++;
+      }
+      const bool known = last < m_last_ids.size() && m_last_ids[last] == ids[k];
+      m_priority[k] = (known ? m_last_priority[last] : ENTERED) + score(k);
+    }
+  }
+
+  // of the k-th body of the last accumulate()
+  float priority(std::size_t k) const {
+    return m_priority[k];
+  }
+
+  void sent(std::size_t k) {
+    m_priority[k] = 0;
+  }
+
+private:
+  std::vector<int32_t> m_ids;
+  std::vector<float> m_priority;
+  std::vector<int32_t> m_last_ids;
+  std::vector<float> m_last_priority;
+};
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <easylogging++.h>
+INITIALIZE_EASYLOGGINGPP
+
+#include "entity.h"
+#include "server.h"
+#include "simulation.h"
+#include "world.h"
+
+// The balls simulation without a window, stepped at a fixed rate and
+// streamed to every client with a session. Try it on one machine with
+//
+//   balls_server
+//   balls -c 127.0.0.1
+//
+//   balls_server [-p port] [-r ticks per second] [-u sends per second]
+//                [-s small|big|orbit]
+//                [-n bodies] [-d seconds to run, 0 for ever]
+//                [-q position steps,velocity steps per unit]
+//                [-b KB per second per client, 0 for no limit]
+//                [-f fragments per parity fragment, 0 for none]
+
+namespace {
+
+// Every few seconds, how much each session costs.
+void report(const Server &server) {
+  if (const uint64_t dropped = server.socket().datagrams_dropped()) {
+    LOG(INFO) << dropped << " datagrams dropped by the socket";
+  }
+  for (const auto &session : server.sessions()) {
+    const Server::Session &s = *session;
+    LOG(INFO) << "Session " << s.id << ": " << s.datagrams_sent
+              << " datagrams, " << s.bytes_sent / 1000 << " KB, "
+              << s.bytes_per_body() << " bytes per body, "
+              << s.bodies_deferred << " bodies deferred, "
+              << s.fragments_sent << " fragments, "
+              << s.interest.visible().size() << " in view, " << s.entered
+              << " entered, " << s.left << " left";
+    for (Channel c : {Channel::Unreliable, Channel::Reliable}) {
+      const ChannelStats &stats = s.endpoint.stats(c);
+      LOG(INFO) << "Session " << s.id << " " << CHANNEL_NAMES[int(c)] << ": "
+                << stats.rtt * 1000 << " ms round trip, " << stats.loss() * 100
+                << "% lost, " << stats.resent << " resent";
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  unsigned short port = DEFAULT_PORT;
+  int rate = 60;
+  int send_rate = 20;
+  std::string scene = "small";
+  int bodies = 100;
+  double duration = 0;
+  Quantization quantization;
+  double budget = 0;
+  int fec = 0;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!std::strcmp(argv[i], "-p")) {
+      port = static_cast<unsigned short>(std::atoi(argv[i + 1]));
+    } else if (!std::strcmp(argv[i], "-r")) {
+      rate = std::max(std::atoi(argv[i + 1]), 1);
+    } else if (!std::strcmp(argv[i], "-u")) {
+      send_rate = std::max(std::atoi(argv[i + 1]), 1);
+    } else if (!std::strcmp(argv[i], "-s")) {
+      scene = argv[i + 1];
+    } else if (!std::strcmp(argv[i], "-n")) {
+      bodies = std::atoi(argv[i + 1]);
+    } else if (!std::strcmp(argv[i], "-d")) {
+      duration = std::atof(argv[i + 1]);
+    } else if (!std::strcmp(argv[i], "-q")) {
+      unsigned position = 0, velocity = 0;
+      if (std::sscanf(argv[i + 1], "%u,%u", &position, &velocity) == 2 &&
+          position > 0 && velocity > 0 && position < 65536 &&
+          velocity < 65536) {
+        quantization = {uint16_t(position), uint16_t(velocity)};
+      }
+    } else if (!std::strcmp(argv[i], "-b")) {
+      budget = std::max(std::atof(argv[i + 1]), 0.0);
+    } else if (!std::strcmp(argv[i], "-f")) {
+      fec = std::clamp(std::atoi(argv[i + 1]), 0, 255);
+    }
+  }
+
+  if (scene == "big") {
+    reset_big();
+  } else if (scene == "orbit") {
+    reset_orbit();
+  } else {
+    reset_small(bodies);
+  }
+
+  Server server;
+  server.tick_rate = rate;
+  server.send_rate = send_rate;
+  server.quantization = quantization;
+  server.budget = uint32_t(std::min(budget * 1000, 4e9));
+  server.fec = uint8_t(fec);
+  if (!server.listen(port)) {
+    return 1;
+  }
+  LOG(INFO) << "Serving " << state.entities.size() << " bodies on port "
+            << server.port() << " at " << rate << " ticks per second";
+
+  using Clock = std::chrono::steady_clock;
+  const auto period = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / rate)
+  );
+  const auto start = Clock::now();
+  auto next = start;
+  auto reported = start;
+
+  for (uint32_t tick = 0;; tick++) {
+    server.receive(state.entities);
+    simulate(1.0f / rate);
+    server.broadcast(tick, state.entities);
+    server.expire();
+
+    const auto now = Clock::now();
+    if (now - reported >= std::chrono::seconds(5)) {
+      report(server);
+      reported = now;
+    }
+    if (duration > 0 &&
+        std::chrono::duration<double>(now - start).count() >= duration) {
+      break;
+    }
+
+    // a tick that ran long pushes the rest back rather than being caught up
+    next = std::max(next + period, now);
+    std::this_thread::sleep_until(next);
+  }
+  return 0;
+}
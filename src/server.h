@@ -0,0 +1,455 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include <easylogging++.h>
+
+#include "API.h"
+#include "channel.h"
+#include "entity.h"
+#include "fragment.h"
+#include "grid.h"
+#include "interest.h"
+#include "priority.h"
+#include "snapshot.h"
+
+inline BodyState body_state(const Entity &e) {
+  const sf::Vector2f c = e.center();
+  const sf::Vector2f v = e.velocity();
+  return {
+      e.id(), c.x, c.y, v.x, v.y, e.radius(),
+      e.shape().getFillColor().toInteger()
+  };
+}
+
+// The authoritative end of the balls protocol. Clients start a session with
+// StartSession, keep it alive with any datagram at least every TIMEOUT, and
+// get the part of the world around their camera streamed to them every
+// broadcast(), as snapshots delta encoded against what they acknowledged.
+// Until a client has acknowledged anything, its whole view goes as one
+// message, fragmented, so it starts from a consistent world.
+class Server {
+public:
+  using Clock = std::chrono::steady_clock;
+  static constexpr std::chrono::seconds TIMEOUT{5};
+  // sessions at once
+  static constexpr std::size_t MAX_PEERS = 256;
+  // of the grid the bodies near each camera are found with
+  static constexpr float INTEREST_CELL = 128;
+  // a World datagram's headers, and a guess at each body's id gap and
+  // baseline reference, for budgeting
+  static constexpr int64_t DATAGRAM_BYTES = PACKET_HEADER + 11;
+  static constexpr std::size_t BODY_BITS = 12;
+
+  // Made only for a StartSession with a version this server speaks, as the
+  // channels alone are most of 100 KB. Anything else from an address without
+  // one is answered without keeping anything, or dropped.
+  struct Session {
+    uint32_t id;
+    Endpoint endpoint;
+    Clock::time_point heard;
+    SnapshotEncoder encoder;
+    bool quit = false;
+    Interest interest = {};
+    PriorityAccumulator priority = {};
+    int64_t allowance = 0; // bytes of the budget unspent, or overspent
+    bool synced = false;   // has acknowledged a snapshot
+    uint64_t bytes_sent = 0;
+    uint64_t datagrams_sent = 0;
+    uint64_t fragments_sent = 0;
+    uint64_t bodies_sent = 0;
+    uint64_t bodies_deferred = 0; // in view but left for a later tick
+    uint64_t entered = 0;
+    uint64_t left = 0;
+
+    // World bytes, headers and all, per body sent
+    float bytes_per_body() const {
+      return bodies_sent ? float(bytes_sent) / bodies_sent : 0.0f;
+    }
+  };
+
+  uint32_t tick_rate = 60;
+  // how often the world is sent, which clients interpolate between
+  uint32_t send_rate = 20;
+  Quantization quantization;
+  // World bytes per second each session may be sent, 0 for no limit
+  uint32_t budget = 0;
+  // fragments per parity fragment, 0 for none
+  uint8_t fec = 0;
+
+  bool listen(unsigned short port) {
+    if (!m_socket.bind(port)) {
+      LOG(ERROR) << "Failure to bind UDP port " << port;
+      return false;
+    }
+    return true;
+  }
+
+  unsigned short port() const {
+    return m_socket.local_port();
+  }
+
+  // Handles every message waiting on the socket, and sends the replies, and
+  // anything reliable that needs sending again.
+  void receive(
+      std::vector<Entity> &entities, Clock::time_point now = Clock::now()
+  ) {
+    while (const Datagram *d = m_socket.receive()) {
+      Session *session = find(d->address, d->port);
+      if (!session) {
+        const auto version = start_request(*d);
+        if (!version) {
+          continue;
+        }
+        if (!compatible(*version)) {
+          reply_unconnected(m_socket, *d, MessageID::Error);
+          continue;
+        }
+        if (m_sessions.size() >= MAX_PEERS) {
+          continue;
+        }
+        session = add(*d, now);
+      }
+      session->heard = now;
+      session->endpoint.receive(*d, now, [&](const Message &m) {
+        handle(m, *session, entities);
+      });
+    }
+    drop([](const Session &s) { return s.quit; });
+
+    for (const auto &s : m_sessions) {
+      s->endpoint.update(m_socket, now);
+    }
+    m_socket.flush();
+  }
+
+  const DatagramSocket &socket() const {
+    return m_socket;
+  }
+
+  // Sends every session the bodies it's interested in, in as many datagrams
+  // as it takes, send_rate times a second. Past one grid build, the work for
+  // each session is in the bodies near its camera rather than in the whole
+  // world.
+  void broadcast(uint32_t tick, std::span<const Entity> entities) {
+    if (m_sessions.empty() || tick % every() != 0) {
+      return;
+    }
+
+    float reach = 0;
+    for (const Entity &e : entities) {
+      reach = std::max(reach, e.radius());
+    }
+    m_index.build(entities, INTEREST_CELL);
+    // bodies are quantized once a tick, the first time a session needs them
+    m_bodies.resize(entities.size());
+    m_quantized.assign(entities.size(), false);
+
+    for (const auto &session : m_sessions) {
+      Session &s = *session;
+      s.interest.update(
+          entities, m_index, reach,
+          [&](int32_t id) {
+            s.encoder.enter(id);
+            s.entered++;
+          },
+          [&](int32_t id) {
+            s.encoder.leave(id);
+            s.left++;
+          }
+      );
+      m_send.clear();
+      for (uint32_t i : s.interest.visible()) {
+        if (!m_quantized[i]) {
+          m_bodies[i] = quantize(body_state(entities[i]), quantization);
+          m_quantized[i] = true;
+        }
+        m_send.push_back(m_bodies[i]);
+      }
+      if (budget && !prioritise(s, tick, entities)) {
+        continue;
+      }
+
+      // an empty world still gets a datagram, so the client sees the tick
+      const uint64_t before = s.bytes_sent;
+      const std::size_t max_bytes = s.synced ? MAX_PAYLOAD - 1 : MAX_MESSAGE;
+      std::span<const QuantizedBody> rest = m_send;
+      for (bool first = true; first || !rest.empty(); first = false) {
+        const std::size_t count =
+            s.encoder.encode(tick, rest, m_buffer, max_bytes);
+        if (send_world(s)) {
+          s.bodies_sent += count;
+        }
+        if (count == 0) {
+          break;
+        }
+        rest = rest.subspan(count);
+      }
+      s.allowance -= int64_t(s.bytes_sent - before);
+    }
+    m_socket.flush();
+  }
+
+  // Drops the sessions that haven't been heard from in TIMEOUT.
+  void expire(Clock::time_point now = Clock::now()) {
+    drop([&](const Session &s) {
+      if (now - s.heard < TIMEOUT) {
+        return false;
+      }
+      LOG(INFO) << "Session " << s.id << " timed out";
+      return true;
+    });
+  }
+
+  const std::vector<std::unique_ptr<Session>> &sessions() const {
+    return m_sessions;
+  }
+
+private:
+  // Sends m_buffer as a World message, in fragments if it needs them.
+  bool send_world(Session &s) {
+    if (m_buffer.size() + 1 <= MAX_PAYLOAD) {
+      if (!s.endpoint.send(m_socket, MessageID::World, m_buffer)) {
+        return false;
+      }
+      s.bytes_sent += PACKET_HEADER + m_buffer.size() + 1;
+      s.datagrams_sent++;
+      return true;
+    }
+    m_fragmenter.group = fec;
+    return m_fragmenter.split(
+        MessageID::World, m_buffer,
+        [&](std::span<const byte> fragment) {
+          if (s.endpoint.send(m_socket, MessageID::Fragment, fragment)) {
+            s.bytes_sent += PACKET_HEADER + fragment.size() + 1;
+            s.datagrams_sent++;
+            s.fragments_sent++;
+          }
+        }
+    );
+  }
+
+  // Narrows m_send down to the most overdue bodies that fit in what's left
+  // of the session's budget, greedily, and says whether to send at all.
+  bool prioritise(Session &s, uint32_t tick, std::span<const Entity> entities) {
+    const auto visible = s.interest.visible();
+    s.priority.accumulate(s.interest.ids(), [&](std::size_t k) {
+      return PriorityAccumulator::score(
+          body_state(entities[visible[k]]), s.interest.view()
+      );
+    });
+
+    // a send's share, and whatever earlier sends left or overspent, saved up
+    // to a datagram so even a tiny budget gets a body through now and then
+    const int64_t share = budget / sends_per_second();
+    s.allowance = std::min(
+        s.allowance + share, std::max<int64_t>(share, MAX_PAYLOAD)
+    );
+
+    m_order.resize(m_send.size());
+    std::iota(m_order.begin(), m_order.end(), 0);
+    std::stable_sort(m_order.begin(), m_order.end(), [&](auto a, auto b) {
+      return s.priority.priority(a) > s.priority.priority(b);
+    });
+    m_picked.assign(m_send.size(), false);
+    int64_t spent = DATAGRAM_BYTES;
+    for (uint32_t k : m_order) {
+      const int64_t cost =
+          (s.encoder.cost(m_send[k], tick) + BODY_BITS + 7) / 8;
+      if (spent + cost <= s.allowance) {
+        spent += cost;
+        m_picked[k] = true;
+        s.priority.sent(k);
+      }
+    }
+
+    std::size_t picked = 0;
+    for (std::size_t k = 0; k < m_send.size(); k++) {
+      if (m_picked[k]) {
+        m_send[picked++] = m_send[k];
+      }
+    }
+    s.bodies_deferred += m_send.size() - picked;
+    m_send.resize(picked);
+    // nothing to say unless there are bodies to drop
+    return picked > 0 || s.encoder.leaving() > 0;
+  }
+
+  void
+  handle(const Message &m, Session &session, std::vector<Entity> &entities) {
+    switch (m.id) {
+    case MessageID::StartSession:
+      start(session);
+      break;
+
+    case MessageID::Version:
+      reply(session, MessageID::Version, Version{VERSION});
+      break;
+
+    case MessageID::EntityID:
+      if (const auto pick = ParseMessage<Pick>(m)) {
+        // the nearest centre, among the bodies under the point
+        const sf::Vector2f at = {pick->get<&Pick::x>(), pick->get<&Pick::y>()};
+        Picked picked = {-1};
+        float nearest = 0;
+        for (const Entity &e : entities) {
+          const sf::Vector2f d = e.center() - at;
+          if (d.length() < e.radius() &&
+              (picked.id < 0 || d.length() < nearest)) {
+            picked.id = e.id();
+            nearest = d.length();
+          }
+        }
+        reply(session, MessageID::EntityID, picked);
+      }
+      break;
+
+    case MessageID::UpdatePosition:
+      if (const auto move = ParseMessage<Move>(m)) {
+        const int32_t id = move->get<&Move::id>();
+        for (Entity &e : entities) {
+          if (e.id() == id) {
+            e.set_center({move->get<&Move::x>(), move->get<&Move::y>()});
+            e.set_velocity({0, 0});
+          }
+        }
+      }
+      break;
+
+    case MessageID::QuitSession:
+      // dropped once the datagrams waiting are handled
+      LOG(INFO) << "Session " << session.id << " quit";
+      session.quit = true;
+      break;
+
+    case MessageID::Ack:
+      if (const auto ack = ParseMessage<Ack>(m)) {
+        session.encoder.ack(
+            ack->get<&Ack::sequence>(), ack->get<&Ack::received>()
+        );
+        session.synced = true;
+      }
+      break;
+
+    case MessageID::Camera:
+      if (const auto camera = ParseMessage<Camera>(m)) {
+        session.interest.look(camera->value());
+      }
+      break;
+
+    case MessageID::Ok:
+    case MessageID::Error:
+    case MessageID::World:
+    case MessageID::Fragment:
+      break;
+    }
+  }
+
+  // The version a datagram from an address without a session asks for, if
+  // it's a StartSession and the first reliable message from there, which is
+  // all that makes a session.
+  static std::optional<Version> start_request(const Datagram &d) {
+    const auto data = d.bytes();
+    const auto header = View<PacketHeader>::of(data);
+    const auto reliable = View<ReliableHeader>::of(data.subspan(
+        std::min(PACKET_HEADER, data.size())
+    ));
+    constexpr std::size_t at = PACKET_HEADER + RELIABLE_HEADER;
+    if (!header || !reliable ||
+        header->get<&PacketHeader::channel>() != Channel::Reliable ||
+        reliable->get<&ReliableHeader::message>() != 0 ||
+        data.size() <= at || MessageID(data[at]) != MessageID::StartSession) {
+      return std::nullopt;
+    }
+    const auto version = View<Version>::of(data.subspan(at + 1));
+    if (!version) {
+      return std::nullopt;
+    }
+    return version->value();
+  }
+
+  static bool compatible(const Version &version) {
+    return version.major == VERSION.major && version.minor == VERSION.minor;
+  }
+
+  Session *add(const Datagram &d, Clock::time_point now) {
+    auto &session = m_sessions.emplace_back(std::make_unique<Session>(
+        m_next_session++, Endpoint(d.address, d.port), now,
+        SnapshotEncoder(quantization, tick_rate)
+    ));
+    m_index_of[key(d.address, d.port)] = session.get();
+    LOG(INFO) << "Session " << session->id << " started for "
+              << d.address.toString() << ":" << d.port;
+    return session.get();
+  }
+
+  // Drops the sessions `f` picks.
+  template <typename F> void drop(F &&f) {
+    std::erase_if(m_sessions, [&](const std::unique_ptr<Session> &s) {
+      if (!f(*s)) {
+        return false;
+      }
+      m_index_of.erase(key(s->endpoint.address(), s->endpoint.port()));
+      return true;
+    });
+  }
+
+  // The answer to StartSession, which is reliable both ways, so each comes
+  // once.
+  void start(Session &session) {
+    reply(
+        session, MessageID::StartSession,
+        SessionInfo{
+            session.id, tick_rate, sends_per_second(), quantization.position,
+            quantization.velocity
+        }
+    );
+  }
+
+  // ticks between sends, so sends are as close to send_rate as whole ticks
+  // allow
+  uint32_t every() const {
+    return std::max(tick_rate / std::max(send_rate, 1u), 1u);
+  }
+
+  uint32_t sends_per_second() const {
+    return std::max(tick_rate, 1u) / every();
+  }
+
+  template <typename T> void reply(Session &session, MessageID id, T data) {
+    session.endpoint.send(m_socket, id, Serialise(data));
+  }
+
+  static uint64_t key(sf::IpAddress address, unsigned short port) {
+    return uint64_t(address.toInteger()) << 16 | port;
+  }
+
+  Session *find(sf::IpAddress address, unsigned short port) {
+    const auto s = m_index_of.find(key(address, port));
+    return s == m_index_of.end() ? nullptr : s->second;
+  }
+
+  DatagramSocket m_socket;
+  // apart, so a session stays put as others come and go
+  std::vector<std::unique_ptr<Session>> m_sessions;
+  std::unordered_map<uint64_t, Session *> m_index_of;
+  uint32_t m_next_session = 1;
+
+  UniformGrid m_index;
+  std::vector<QuantizedBody> m_bodies; // this tick's, by entity
+  std::vector<bool> m_quantized;
+  std::vector<QuantizedBody> m_send; // one session's, by id
+  std::vector<uint32_t> m_order;
+  std::vector<bool> m_picked;
+  bytes m_buffer;
+  Fragmenter m_fragmenter;
+};
@@ -0,0 +1,524 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "broadphase.h"
+#include "contacts.h"
+#include "costzones.h"
+#include "diagnostics.h"
+#include "entity.h"
+#include "governor.h"
+#include "jobs.h"
+#include "pairs.h"
+#include "perf.h"
+#include "trace.h"
+#include "tree.h"
+#include "world.h"
+
+// The balls simulation without any window or UI, shared by the balls app and
+// the headless benchmark.
+
+enum class ContactSolver
+{
+  // the original velocity exchange in collide_with_entity
+  Elastic,
+  // sequential impulses, warm started from the contact cache
+  Impulse,
+};
+
+inline constexpr const char *CONTACT_SOLVER_NAMES[] = {"Elastic", "Impulse"};
+
+struct State {
+  std::vector<Entity> entities;
+  uint64_t frame = 0;
+  std::atomic<int> bounce = 0;
+  Diagnostics diagnostics;
+
+  sf::Vector2f camera_position = {0.0, 0.0};
+
+  bool enable_gravity = true;
+  float gravity = 1e2;
+  GravityTree tree;
+
+  // chosen by the governor, or by hand when it's off
+  Fidelity fidelity;
+  Governor governor;
+  PhaseTimes phases; // of the last frame
+  PerfHistory perf;
+
+  bool enable_walls = true;
+  bool enable_collisions = true;
+  CollisionPairs collisions;
+  ContactGraph contacts;
+  ContactSolver solver = ContactSolver::Elastic;
+  int solver_iterations = 1;
+  bool warm_start = true;
+  ContactCache contact_cache;
+  float solver_error = 0;
+
+  // per-body work split across threads, and the contacts each zone found
+  CostZones zones;
+  std::vector<std::vector<Contact>> zone_contacts;
+
+  float elasticity = 1.0f;
+  float drag = 0.0f;
+  float step_drag = 0.0f; // per substep, adding up to drag over a frame
+};
+
+inline State state;
+
+inline void reset_state() {
+  state.frame = 0;
+  state.diagnostics.reset();
+  state.entities.clear();
+  state.collisions.invalidate();
+  state.contact_cache.clear();
+  state.collisions.reset_metrics();
+  state.zones.clear();
+  state.governor.reset();
+  if (state.governor.enabled) {
+    state.fidelity = state.governor.fidelity();
+  }
+}
+
+inline void
+reset_small(int count = 100, unsigned seed = std::random_device{}()) {
+  reset_state();
+
+  std::default_random_engine e(seed);
+  std::uniform_real_distribution<float> wg(100, WORLD_WIDTH - 100);
+  std::uniform_real_distribution<float> hg(100, WORLD_HEIGHT - 100);
+  std::uniform_real_distribution<float> sg(5, 20);
+  std::uniform_real_distribution<float> dg(1.0f, 5.0f);
+  std::uniform_int_distribution<int> cg(0, 255);
+
+  for (int i = 0; i < count; i++) {
+    state.entities.emplace_back(
+        sf::Vector2f{wg(e), hg(e)}, sf::Vector2f{0, 0}, sg(e), dg(e),
+        sf::Color(cg(e), cg(e), cg(e))
+    );
+  }
+}
+
+inline void reset_big() {
+  reset_state();
+
+  state.entities.emplace_back(
+      sf::Vector2f{150.0f, 200.0f}, sf::Vector2f{0, 0}, 50, 50, sf::Color::Green
+  );
+  state.entities.emplace_back(
+      sf::Vector2f{300.0f, 290.0f}, sf::Vector2f{-50, 0}, 50, 50, sf::Color::Red
+  );
+}
+
+inline void reset_orbit() {
+  reset_state();
+
+  state.entities.emplace_back(
+      sf::Vector2f{450.0f, 450.0f}, sf::Vector2f{0, 0}, 50, 500,
+      sf::Color::Green
+  );
+  state.entities.emplace_back(
+      sf::Vector2f{250.0f, 450.0f}, sf::Vector2f{0, 1600}, 50, 0.05f,
+      sf::Color::Red
+  );
+}
+
+inline void drag_entity(Entity &e) {
+  e.velocity() *= 1 - state.step_drag;
+}
+
+inline void collide_with_walls(Entity &e) {
+  const float dist_from_ground = WORLD_HEIGHT - e.position().y - e.diameter();
+  if (dist_from_ground <= 0) {
+    e.velocity().y *= -1 * state.elasticity;
+    e.position().y = WORLD_HEIGHT - e.diameter();
+  }
+
+  if (e.position().y <= 0) {
+    e.velocity().y *= -1 * state.elasticity;
+    e.position().y = 0;
+  }
+
+  if (e.position().x <= 0) {
+    e.velocity().x *= -1 * state.elasticity;
+    e.position().x = 0;
+    state.bounce += 1;
+  }
+
+  const float dist_from_right = WORLD_WIDTH - e.position().x - e.diameter();
+  if (dist_from_right <= 0) {
+    e.velocity().x *= -1 * state.elasticity;
+    e.position().x = WORLD_WIDTH - e.diameter();
+  }
+}
+
+// returns true if the entities were touching
+inline bool collide_with_entity(Entity &a, Entity &b) {
+  if (!a.collides(b))
+    return false;
+
+  const sf::Vector2f normal = (b.center() - a.center()).normalized();
+  const sf::Vector2f tangent = {-normal.y, normal.x};
+
+  // move balls apart until they're no longer touching
+  float overlap = a.radius() + b.radius() - (a.center() - b.center()).length();
+
+  float sa = a.velocity().length();
+  float sb = b.velocity().length();
+  if (sa == 0 && sb == 0) {
+    a.position() -= overlap * normal * 0.5f;
+    b.position() += overlap * normal * 0.5f;
+  } else {
+    a.position() -= overlap * normal * sa / (sa + sb);
+    b.position() += overlap * normal * sb / (sa + sb);
+  }
+
+  // inverse total mass
+  const float itm = 1.0 / (a.mass() + b.mass());
+
+  // the normal/tangent components of the collision.
+  const sf::Vector2f van = a.velocity().projectedOnto(normal);
+  const sf::Vector2f vbn = b.velocity().projectedOnto(normal);
+  const sf::Vector2f vat = a.velocity().projectedOnto(tangent);
+  const sf::Vector2f vbt = b.velocity().projectedOnto(tangent);
+
+  // Derived from conservation of momentum
+  a.velocity() = ((a.mass() - b.mass()) * itm * van + 2 * b.mass() * itm * vbn
+                 ) * state.elasticity +
+                 vat;
+  b.velocity() = ((b.mass() - a.mass()) * itm * vbn + 2 * a.mass() * itm * van
+                 ) * state.elasticity +
+                 vbt;
+  return true;
+}
+
+// below this approach speed a contact is resting and doesn't bounce
+static constexpr float RESTING_SPEED = 5.0f;
+// overlap left alone, so resting contacts stay touching between frames
+static constexpr float CONTACT_SLOP = 0.5f;
+
+inline void apply_impulse(const Contact &c, Entity &a, Entity &b, float j) {
+  a.velocity() -= j / a.mass() * c.normal;
+  b.velocity() += j / b.mass() * c.normal;
+}
+
+// Sets a contact up for the impulse solver, starting from last frame's
+// impulse for the same pair if there was one.
+inline void prepare_contact(Contact &c, Entity &a, Entity &b) {
+  c.normal = (b.center() - a.center()).normalized();
+  c.mass = 1.0f / (1.0f / a.mass() + 1.0f / b.mass());
+
+  const float approach = (b.velocity() - a.velocity()).dot(c.normal);
+  c.target = approach < -RESTING_SPEED ? -state.elasticity * approach : 0.0f;
+
+  c.key = ContactCache::key(a.id(), b.id());
+  c.impulse = state.warm_start ? state.contact_cache.find(c.key) : 0.0f;
+  apply_impulse(c, a, b, c.impulse);
+}
+
+// One impulse iteration. The accumulated impulse may shrink but never pull
+// the bodies together.
+inline void resolve_contact(Contact &c, Entity &a, Entity &b) {
+  const float velocity = (b.velocity() - a.velocity()).dot(c.normal);
+  const float impulse =
+      std::max(c.impulse + c.mass * (c.target - velocity), 0.0f);
+  apply_impulse(c, a, b, impulse - c.impulse);
+  c.impulse = impulse;
+}
+
+// Moves overlapping bodies apart in inverse proportion to their mass.
+inline void separate_contact(Contact &c, Entity &a, Entity &b) {
+  const float distance = (b.center() - a.center()).length();
+  const float overlap = a.radius() + b.radius() - distance - CONTACT_SLOP;
+  if (overlap <= 0)
+    return;
+
+  const sf::Vector2f push = overlap * c.mass * c.normal;
+  a.position() -= push / a.mass();
+  b.position() += push / b.mass();
+}
+
+inline void resolve_contacts(std::span<Entity> entities) {
+  ContactGraph &contacts = state.contacts;
+
+  switch (state.solver) {
+  case ContactSolver::Elastic:
+    contacts.solve(entities, collide_with_entity, state.solver_iterations);
+    break;
+
+  case ContactSolver::Impulse: {
+    contacts.solve(entities, prepare_contact);
+    contacts.solve(entities, resolve_contact, state.solver_iterations);
+
+    // how far the contacts are from their target velocities, on average
+    float error = 0;
+    for (const Contact &c : contacts.contacts()) {
+      const sf::Vector2f relative =
+          entities[c.b].velocity() - entities[c.a].velocity();
+      error += std::max(c.target - relative.dot(c.normal), 0.0f);
+    }
+    state.solver_error = contacts.size() ? error / contacts.size() : 0.0f;
+
+    contacts.solve(entities, separate_contact);
+    state.contact_cache.store(contacts.contacts());
+    break;
+  }
+  }
+}
+
+inline void gravity(Entity &a, Entity &b) {
+  sf::Vector2f dist = a.center() - b.center();
+
+  sf::Vector2f force = state.gravity * a.mass() * b.mass() * dist.normalized() /
+                       dist.lengthSquared();
+
+  a.push(-force);
+  b.push(force);
+}
+
+// Pulls a towards a mass at the given point, a body or a whole tree node.
+inline void gravity_from(Entity &a, float mass, sf::Vector2f at) {
+  sf::Vector2f dist = a.center() - at;
+
+  a.push(
+      -state.gravity * a.mass() * mass * dist.normalized() /
+      dist.lengthSquared()
+  );
+}
+
+// Pulls a towards b, leaving b alone.
+inline void gravity_on(Entity &a, const Entity &b) {
+  sf::Vector2f dist = a.center() - b.center();
+
+  a.push(
+      -state.gravity * a.mass() * b.mass() * dist.normalized() /
+      dist.lengthSquared()
+  );
+}
+
+// Integrator policy for step(). Entity::tick is semi-implicit Euler: velocity
+// is updated first and the new velocity moves the position.
+struct SemiImplicitEuler {
+  static void integrate(Entity &e, float delta_time) {
+    e.tick(delta_time);
+  }
+};
+
+// One simulation step with the enabled features baked in at compile time, so
+// the per-body and per-pair loops carry no flag checks. simulate() picks the
+// matching instantiation once per frame. With `sample`, the diagnostics are
+// summed in the step too, from the bodies as the step found them.
+template <
+    bool Gravity, bool Walls, bool Drag, bool Collisions,
+    typename Integrator = SemiImplicitEuler>
+void step(float delta_time, bool sample) {
+  TRACE_ZONE("step");
+  using Job = JobGraph::Job;
+
+  const std::span<Entity> entities = state.entities;
+  const std::size_t n = entities.size();
+  PhaseTimes &phases = state.phases;
+
+  // The frame is a graph of jobs: the broadphase and the gravity tree, then
+  // the interaction pass, then contacts, then integration. The diagnostics'
+  // sums only read the bodies and the forces only write forces, so when a
+  // sample is due they run side by side, ahead of contacts.
+  JobGraph frame(jobs());
+
+  Diagnostics::Sums sums;
+  if (sample) {
+    sums = state.diagnostics.measure(
+        frame, entities, Gravity ? state.gravity : 0.0f
+    );
+  }
+
+  Job *broadphase = nullptr;
+  if constexpr (Collisions) {
+    broadphase = frame.add([&] {
+      phases.time(Phase::Broadphase, [&] {
+        state.collisions.update(entities);
+      });
+    });
+  }
+
+  const bool tree = Gravity && state.fidelity.gravity == GravitySolver::Tree;
+  const float theta = state.fidelity.theta;
+  Job *build = nullptr;
+  if (tree) {
+    build = frame.add([&] {
+      phases.time(Phase::Tree, [&] {
+        state.tree.build(std::span<const Entity>(entities));
+      });
+    });
+  }
+
+  // Per-body interactions: every body sums the pull of all the others and
+  // tests its own neighbour list row for contacts, so no two jobs write the
+  // same body. How much work a body is depends on how crowded it is, so the
+  // bodies are split into cost zones rather than even ranges.
+  const bool rows =
+      Collisions && state.collisions.broadphase != Broadphase::SweepAndPrune;
+  CostZones &zones = state.zones;
+  Job *interact = nullptr;
+  if ((Gravity || rows) && (jobs().size() > 1 || tree)) {
+    TRACE_ZONE("cost zones");
+    zones.partition(entities, jobs().size());
+    state.zone_contacts.resize(zones.zones());
+
+    interact = frame.parallel_for(
+        zones.bounds(),
+        [&](std::size_t, std::size_t, std::size_t z) {
+          phases.time(Phase::Interactions, [&] {
+            zones.timed(z, [&](std::span<const uint32_t> zone) {
+              const CSR &list = state.collisions.neighbours.pairs();
+              std::vector<Contact> &found = state.zone_contacts[z];
+              found.clear();
+
+              for (uint32_t i : zone) {
+                uint32_t count = 0;
+                if constexpr (Gravity) {
+                  if (tree) {
+                    count += state.tree.for_each_source(
+                        i, theta,
+                        [&](float mass, sf::Vector2f at) {
+                          gravity_from(entities[i], mass, at);
+                        }
+                    );
+                  } else {
+                    AllPairs{}.for_each_in_row(
+                        entities, i,
+                        [&](Entity &a, const Entity &b) {
+                          gravity_on(a, b);
+                        }
+                    );
+                    count += n - 1;
+                  }
+                }
+                if (rows) {
+                  for (uint32_t j : list.row(i)) {
+                    if (entities[i].collides(entities[j])) {
+                      found.push_back({i, j});
+                    }
+                  }
+                  count += list.row(i).size();
+                }
+                zones.cost(i) = count;
+              }
+            });
+          });
+        },
+        {broadphase, build}
+    );
+  } else {
+    // one thread: visit each pair once from both sides instead
+    zones.clear();
+    if constexpr (Gravity) {
+      interact = frame.add([&] {
+        phases.time(Phase::Interactions, [&] {
+          for_each_pair(AllPairs{}, entities, gravity);
+        });
+      });
+    }
+  }
+
+  // contacts are gathered up front and resolved one colour at a time, so
+  // the bodies within a colour can be updated in parallel
+  Job *collide = nullptr;
+  if constexpr (Collisions) {
+    collide = frame.add(
+        [&] {
+          phases.time(Phase::Contacts, [&] {
+            if (rows && zones.zones() > 0) {
+              state.contacts.gather(n, std::span(state.zone_contacts));
+            } else {
+              state.contacts.gather(entities, state.collisions);
+            }
+            state.collisions.record_contacts(state.contacts.size());
+            resolve_contacts(entities);
+          });
+        },
+        {broadphase, interact, sums.bodies, sums.pairs}
+    );
+  }
+
+  frame.parallel_for(
+      n,
+      [&](std::size_t begin, std::size_t end, std::size_t) {
+        phases.time(Phase::Integrate, [&] {
+          for (std::size_t i = begin; i < end; i++) {
+            Entity &e = entities[i];
+            if constexpr (Walls) {
+              collide_with_walls(e);
+            }
+
+            if constexpr (Drag) {
+              drag_entity(e);
+            }
+            Integrator::integrate(e, delta_time);
+          }
+        });
+      },
+      {interact, collide, sums.bodies, sums.pairs}
+  );
+
+  frame.run();
+}
+
+using StepFunction = void (*)(float, bool);
+
+// Every feature combination, indexed by the flag bits built in simulate().
+template <std::size_t... I>
+constexpr std::array<StepFunction, sizeof...(I)>
+make_steps(std::index_sequence<I...>) {
+  return {&step<bool(I & 1), bool(I & 2), bool(I & 4), bool(I & 8)>...};
+}
+
+constexpr auto steps = make_steps(std::make_index_sequence<16>{});
+
+// Advances the simulation by delta_time seconds, in as many steps as the
+// fidelity asks for, then lets the governor pick the next frame's fidelity.
+inline void simulate(float delta_time) {
+  TRACE_ZONE("simulate");
+  const auto start = std::chrono::steady_clock::now();
+  const int substeps = std::max(state.fidelity.substeps, 1);
+  state.step_drag = 1 - std::pow(1 - state.drag, 1.0f / substeps);
+  state.phases.clear();
+
+  const std::size_t features = (state.enable_gravity ? 1 : 0) |
+                               (state.enable_walls ? 2 : 0) |
+                               (state.drag != 0 ? 4 : 0) |
+                               (state.enable_collisions ? 8 : 0);
+  // summed by the first step, which finds the bodies as the last frame left
+  // them
+  const bool sample = state.diagnostics.due(state.frame);
+  for (int s = 0; s < substeps; s++) {
+    steps[features](delta_time / substeps, sample && s == 0);
+  }
+  if (sample) {
+    TRACE_ZONE("diagnostics");
+    state.diagnostics.finish(state.frame);
+  }
+
+  const std::chrono::duration<float, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  if (state.governor.enabled) {
+    state.fidelity = state.governor.update(elapsed.count());
+  }
+  state.perf.step(
+      elapsed.count(), state.phases,
+      state.enable_collisions ? state.collisions.candidates() : 0,
+      state.enable_collisions ? state.contacts.size() : 0
+  );
+  state.frame += 1;
+}
@@ -0,0 +1,665 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "API.h"
+
+// World snapshots, quantized, delta encoded and bit packed.
+//
+// Positions and velocities are rounded to fixed steps per unit. Each body is
+// sent relative to the newest state of it the client has acknowledged (its
+// baseline): the velocity as a difference and the position as the error of
+// a prediction from the baseline's position and velocity. A body drifting
+// steadily costs a few bits. A body the client has no baseline for is sent
+// whole.
+//
+// A World payload is a 10 byte header (sequence, tick, body count), the
+// bodies the client should drop, as a varint count and then varint id gaps,
+// and then the bodies, in increasing id order:
+//
+//   id gap        varint, ids between this body and the last one
+//   baseline      0: same as the last body, or 1 and a varint of
+//                 sequence - baseline sequence, 0 for none
+//   position      two zigzag varints
+//   velocity      two zigzag varints
+//   appearance    without a baseline: radius (16 bits) and colour (32 bits);
+//                 with one: a bit saying whether they follow
+//
+// where a varint is 0, 10 + 4 bits, 110 + 8 bits, 1110 + 16 bits or
+// 1111 + 32 bits.
+
+// How finely bodies are sent, in steps per unit.
+struct Quantization {
+  uint16_t position = 16;
+  uint16_t velocity = 4;
+};
+
+inline constexpr uint32_t RADIUS_STEPS = 8; // per unit
+
+struct QuantizedBody {
+  int32_t id;
+  int32_t x, y;
+  int32_t vx, vy;
+  uint16_t radius;
+  uint32_t color;
+
+  bool operator==(const QuantizedBody &) const = default;
+};
+
+inline int32_t quantize(float value, uint32_t steps) {
+  const double q = std::round(double(value) * steps);
+  // NaN and anything out of range end up at 0 and the limits
+  return q == q ? int32_t(std::clamp(q, -2147483647.0, 2147483647.0)) : 0;
+}
+
+inline QuantizedBody quantize(const BodyState &b, Quantization q) {
+  return {
+      b.id,
+      quantize(b.x, q.position),
+      quantize(b.y, q.position),
+      quantize(b.vx, q.velocity),
+      quantize(b.vy, q.velocity),
+      uint16_t(std::clamp(quantize(b.radius, RADIUS_STEPS), 0, 65535)),
+      b.color
+  };
+}
+
+inline BodyState dequantize(const QuantizedBody &b, Quantization q) {
+  return {
+      b.id,
+      float(b.x) / q.position,
+      float(b.y) / q.position,
+      float(b.vx) / q.velocity,
+      float(b.vy) / q.velocity,
+      float(b.radius) / RADIUS_STEPS,
+      b.color
+  };
+}
+
+// Where a body at p moving at v will be `ticks` later, in position steps.
+// Integer only, so both ends predict exactly the same.
+inline int32_t
+predict(int32_t p, int32_t v, uint32_t ticks, Quantization q, uint32_t rate) {
+  const int64_t num = int64_t(v) * ticks * q.position;
+  const int64_t den = int64_t(q.velocity) * std::max(rate, 1u);
+  const int64_t moved = (num + (num < 0 ? -den / 2 : den / 2)) / den;
+  return int32_t(std::clamp<int64_t>(p + moved, INT32_MIN, INT32_MAX));
+}
+
+// a - b and a + b, wrapping rather than overflowing
+inline int32_t difference(int32_t a, int32_t b) {
+  return int32_t(uint32_t(a) - uint32_t(b));
+}
+
+inline int32_t offset(int32_t a, int32_t b) {
+  return int32_t(uint32_t(a) + uint32_t(b));
+}
+
+class BitWriter {
+public:
+  explicit BitWriter(bytes &out) : m_out(out), m_bits(out.size() * 8) {
+  }
+
+  void write(uint32_t value, int bits) {
+    for (int b = 0; b < bits; b++, m_bits++) {
+      if (m_bits % 8 == 0) {
+        m_out.push_back(0);
+      }
+      m_out.back() |= ((value >> b) & 1) << (m_bits % 8);
+    }
+  }
+
+  void write_varint(uint32_t value) {
+    if (value == 0) {
+      write(0b0, 1);
+    } else if (value < (1u << 4)) {
+      write(0b01, 2);
+      write(value, 4);
+    } else if (value < (1u << 8)) {
+      write(0b011, 3);
+      write(value, 8);
+    } else if (value < (1u << 16)) {
+      write(0b0111, 4);
+      write(value, 16);
+    } else {
+      write(0b1111, 4);
+      write(value, 32);
+    }
+  }
+
+  void write_signed(int32_t value) {
+    write_varint(zigzag(value));
+  }
+
+  // what write_varint and write_signed would take, without writing
+  static int varint_bits(uint32_t value) {
+    return value == 0             ? 1
+           : value < (1u << 4)  ? 6
+           : value < (1u << 8)  ? 11
+           : value < (1u << 16) ? 20
+                                : 36;
+  }
+
+  static int signed_bits(int32_t value) {
+    return varint_bits(zigzag(value));
+  }
+
+  std::size_t bits() const {
+    return m_bits;
+  }
+
+  // Forgets everything written after `bits`.
+  void rewind(std::size_t bits) {
+    m_bits = bits;
+    m_out.resize((bits + 7) / 8);
+    if (bits % 8) {
+      m_out.back() &= (1u << (bits % 8)) - 1;
+    }
+  }
+
+private:
+  static uint32_t zigzag(int32_t value) {
+    return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+  }
+
+  bytes &m_out;
+  std::size_t m_bits;
+};
+
+// Reads what BitWriter wrote. Reading past the end gives zeros and sets
+// failed(), so a short or corrupt datagram can't read out of bounds.
+class BitReader {
+public:
+  explicit BitReader(std::span<const byte> data) : m_data(data) {
+  }
+
+  uint32_t read(int bits) {
+    uint32_t value = 0;
+    for (int b = 0; b < bits; b++, m_bits++) {
+      if (m_bits / 8 >= m_data.size()) {
+        m_failed = true;
+        return 0;
+      }
+      value |= uint32_t((m_data[m_bits / 8] >> (m_bits % 8)) & 1) << b;
+    }
+    return value;
+  }
+
+  uint32_t read_varint() {
+    int ones = 0;
+    while (ones < 4 && read(1)) {
+      ones++;
+    }
+    static constexpr int WIDTHS[] = {0, 4, 8, 16, 32};
+    return read(WIDTHS[ones]);
+  }
+
+  int32_t read_signed() {
+    const uint32_t z = read_varint();
+    return int32_t((z >> 1) ^ -(z & 1));
+  }
+
+  bool failed() const {
+    return m_failed;
+  }
+
+private:
+  std::span<const byte> m_data;
+  std::size_t m_bits = 0;
+  bool m_failed = false;
+};
+
+// A client keeps this many of the newest states of each body to decode
+// against, so the server only uses a baseline with fewer newer sends.
+inline constexpr uint32_t SNAPSHOT_KEEP = 8;
+
+// at most this many leaving bodies in a payload, the rest wait for the next
+inline constexpr uint32_t SNAPSHOT_LEAVES = 128;
+
+// The server's end, one per client.
+class SnapshotEncoder {
+public:
+  // packets remembered for acks
+  static constexpr std::size_t HISTORY = 256;
+
+  SnapshotEncoder(Quantization q = {}, uint32_t rate = 60)
+    : m_quantization(q), m_rate(rate), m_history(HISTORY) {
+  }
+
+  // Writes a World payload to `out` with as many of `bodies` (sorted by id)
+  // as fit in `max_bytes` and returns how many that was.
+  std::size_t encode(
+      uint32_t tick, std::span<const QuantizedBody> bodies, bytes &out,
+      std::size_t max_bytes
+  ) {
+    const uint32_t sequence = m_sequence++;
+    Sent &sent = m_history[sequence % HISTORY];
+    sent.sequence = sequence;
+    sent.tick = tick;
+    sent.acked = false;
+    sent.bodies.clear();
+    sent.leaves.clear();
+
+    out.clear();
+    BitWriter w(out);
+    w.write(sequence, 32);
+    w.write(tick, 32);
+    w.write(0, 16); // count, filled in below
+
+    // every leave goes out again until a packet with it is acknowledged
+    const std::size_t leaves = std::min<std::size_t>(
+        m_leaving.size(), SNAPSHOT_LEAVES
+    );
+    w.write_varint(uint32_t(leaves));
+    int64_t last_id = -1;
+    for (std::size_t i = 0; i < leaves; i++) {
+      w.write_varint(uint32_t(m_leaving[i].id - last_id - 1));
+      last_id = m_leaving[i].id;
+      sent.leaves.push_back(m_leaving[i].id);
+    }
+
+    last_id = -1;
+    uint32_t last_reference = 0;
+    std::size_t count = 0;
+    for (const QuantizedBody &b : bodies) {
+      const std::size_t mark = w.bits();
+      Replica &r = m_replicas[b.id];
+      const bool delta = usable(r);
+      const uint32_t reference = delta ? sequence - r.baseline_sequence : 0;
+
+      w.write_varint(uint32_t(b.id - last_id - 1));
+      if (reference == last_reference) {
+        w.write(0, 1);
+      } else {
+        w.write(1, 1);
+        w.write_varint(reference);
+      }
+
+      if (delta) {
+        const QuantizedBody &base = r.baseline;
+        const uint32_t ticks = tick - r.baseline_tick;
+        w.write_signed(difference(b.x, predict(base.x, base.vx, ticks)));
+        w.write_signed(difference(b.y, predict(base.y, base.vy, ticks)));
+        w.write_signed(difference(b.vx, base.vx));
+        w.write_signed(difference(b.vy, base.vy));
+        const bool changed = b.radius != base.radius || b.color != base.color;
+        w.write(changed, 1);
+        if (changed) {
+          w.write(b.radius, 16);
+          w.write(b.color, 32);
+        }
+      } else {
+        w.write_signed(b.x);
+        w.write_signed(b.y);
+        w.write_signed(b.vx);
+        w.write_signed(b.vy);
+        w.write(b.radius, 16);
+        w.write(b.color, 32);
+      }
+
+      if (out.size() > max_bytes || count == UINT16_MAX) {
+        w.rewind(mark);
+        break;
+      }
+      last_id = b.id;
+      last_reference = reference;
+      r.sent++;
+      sent.bodies.push_back({b, r.sent});
+      count++;
+    }
+
+    out[8] = byte(count);
+    out[9] = byte(count >> 8);
+    return count;
+  }
+
+  // Takes the client's newest sequence and a bit per sequence before it.
+  // Every body in an acknowledged packet gets a newer baseline.
+  void ack(uint32_t sequence, uint32_t received) {
+    acknowledge(sequence);
+    for (uint32_t k = 0; k < 32; k++) {
+      if (received & (1u << k)) {
+        acknowledge(sequence - 1 - k);
+      }
+    }
+  }
+
+  // Forgets a body, so the next time it's sent it's sent whole.
+  void forget(int32_t id) {
+    m_replicas.erase(id);
+  }
+
+  // Roughly the bits `b` would take in a payload at `tick`: all but its id
+  // gap and baseline reference, which depend on the bodies around it.
+  std::size_t cost(const QuantizedBody &b, uint32_t tick) const {
+    const auto it = m_replicas.find(b.id);
+    if (it == m_replicas.end() || !usable(it->second)) {
+      return BitWriter::signed_bits(b.x) + BitWriter::signed_bits(b.y) +
+             BitWriter::signed_bits(b.vx) + BitWriter::signed_bits(b.vy) +
+             16 + 32;
+    }
+    const Replica &r = it->second;
+    const QuantizedBody &base = r.baseline;
+    const uint32_t ticks = tick - r.baseline_tick;
+    const bool changed = b.radius != base.radius || b.color != base.color;
+    return BitWriter::signed_bits(
+               difference(b.x, predict(base.x, base.vx, ticks))
+           ) +
+           BitWriter::signed_bits(
+               difference(b.y, predict(base.y, base.vy, ticks))
+           ) +
+           BitWriter::signed_bits(difference(b.vx, base.vx)) +
+           BitWriter::signed_bits(difference(b.vy, base.vy)) + 1 +
+           (changed ? 16 + 32 : 0);
+  }
+
+  // Stops sending a body and tells the client to drop it.
+  void leave(int32_t id) {
+    forget(id);
+    const auto it = leaving(id);
+    if (it == m_leaving.end() || it->id != id) {
+      m_leaving.insert(it, {id, m_sequence});
+    }
+  }
+
+  // Sends a body again, without telling the client to drop it first.
+  void enter(int32_t id) {
+    const auto it = leaving(id);
+    if (it != m_leaving.end() && it->id == id) {
+      m_leaving.erase(it);
+    }
+  }
+
+  // leaves not yet acknowledged
+  std::size_t leaving() const {
+    return m_leaving.size();
+  }
+
+private:
+  struct Replica {
+    bool has_baseline = false;
+    uint32_t baseline_sequence = 0;
+    uint32_t baseline_tick = 0;
+    uint32_t baseline_sent = 0; // `sent` when the baseline was sent
+    QuantizedBody baseline;
+    uint32_t sent = 0; // times this body was sent
+  };
+
+  struct Sent {
+    uint32_t sequence = 0;
+    uint32_t tick = 0;
+    bool acked = true; // nothing to acknowledge in an empty slot
+    struct Body {
+      QuantizedBody state;
+      uint32_t sent;
+    };
+    std::vector<Body> bodies;
+    std::vector<int32_t> leaves;
+  };
+
+  struct Leaving {
+    int32_t id;
+    uint32_t since; // the first sequence that could carry it
+  };
+
+  std::vector<Leaving>::iterator leaving(int32_t id) {
+    return std::lower_bound(
+        m_leaving.begin(), m_leaving.end(), id,
+        [](const Leaving &l, int32_t id) { return l.id < id; }
+    );
+  }
+
+  int32_t predict(int32_t p, int32_t v, uint32_t ticks) const {
+    return ::predict(p, v, ticks, m_quantization, m_rate);
+  }
+
+  // whether the client still has the baseline to decode against
+  static bool usable(const Replica &r) {
+    return r.has_baseline && r.sent - r.baseline_sent < SNAPSHOT_KEEP;
+  }
+
+  void acknowledge(uint32_t sequence) {
+    Sent &sent = m_history[sequence % HISTORY];
+    if (sent.acked || sent.sequence != sequence) {
+      return;
+    }
+    sent.acked = true;
+    for (int32_t id : sent.leaves) {
+      // unless it has left again since
+      const auto it = leaving(id);
+      if (it != m_leaving.end() && it->id == id &&
+          int32_t(sequence - it->since) >= 0) {
+        m_leaving.erase(it);
+      }
+    }
+    for (const auto &b : sent.bodies) {
+      const auto it = m_replicas.find(b.state.id);
+      if (it == m_replicas.end()) {
+        continue;
+      }
+      Replica &r = it->second;
+      if (!r.has_baseline || int32_t(sequence - r.baseline_sequence) > 0) {
+        r.has_baseline = true;
+        r.baseline_sequence = sequence;
+        r.baseline_tick = sent.tick;
+        r.baseline_sent = b.sent;
+        r.baseline = b.state;
+      }
+    }
+  }
+
+  Quantization m_quantization;
+  uint32_t m_rate;
+  uint32_t m_sequence = 0;
+  std::vector<Sent> m_history;
+  std::unordered_map<int32_t, Replica> m_replicas;
+  std::vector<Leaving> m_leaving; // by id
+};
+
+// The client's end. Decodes World payloads against the states it kept and
+// collects what to acknowledge.
+class SnapshotDecoder {
+public:
+  SnapshotDecoder(Quantization q = {}, uint32_t rate = 60)
+    : m_quantization(q), m_rate(rate) {
+  }
+
+  // Calls leave(int32_t id) for every body the client should drop and
+  // f(const QuantizedBody &) for every body in the payload and returns its
+  // tick, or nothing if the payload is malformed.
+  template <typename F, typename L>
+  std::optional<uint32_t>
+  decode(std::span<const byte> payload, F &&f, L &&leave) {
+    BitReader r(payload);
+    const uint32_t sequence = r.read(32);
+    const uint32_t tick = r.read(32);
+    const uint32_t count = r.read(16);
+
+    // decoded in full before anything is kept, so a bad payload changes
+    // nothing
+    m_leaves.clear();
+    const uint32_t leaves = r.read_varint();
+    int64_t id = -1;
+    for (uint32_t i = 0; i < leaves && !r.failed(); i++) {
+      id += int64_t(r.read_varint()) + 1;
+      m_leaves.push_back(int32_t(id));
+    }
+
+    m_decoded.clear();
+    id = -1;
+    uint32_t reference = 0;
+    for (uint32_t i = 0; i < count && !r.failed(); i++) {
+      QuantizedBody b;
+      id += int64_t(r.read_varint()) + 1;
+      b.id = int32_t(id);
+      if (r.read(1)) {
+        reference = r.read_varint();
+      }
+
+      if (reference != 0) {
+        const Kept *base = find(b.id, sequence - reference);
+        if (!base) {
+          return std::nullopt;
+        }
+        const uint32_t ticks = tick - base->tick;
+        const QuantizedBody &s = base->state;
+        b.x = offset(predict(s.x, s.vx, ticks), r.read_signed());
+        b.y = offset(predict(s.y, s.vy, ticks), r.read_signed());
+        b.vx = offset(s.vx, r.read_signed());
+        b.vy = offset(s.vy, r.read_signed());
+        b.radius = s.radius;
+        b.color = s.color;
+        if (r.read(1)) {
+          b.radius = uint16_t(r.read(16));
+          b.color = r.read(32);
+        }
+      } else {
+        b.x = r.read_signed();
+        b.y = r.read_signed();
+        b.vx = r.read_signed();
+        b.vy = r.read_signed();
+        b.radius = uint16_t(r.read(16));
+        b.color = r.read(32);
+      }
+      m_decoded.push_back(b);
+    }
+    if (r.failed()) {
+      return std::nullopt;
+    }
+
+    for (int32_t left : m_leaves) {
+      drop(left, sequence);
+      leave(left);
+    }
+    for (const QuantizedBody &b : m_decoded) {
+      keep(b, sequence, tick);
+      f(b);
+    }
+    received(sequence);
+    return tick;
+  }
+
+  // the tick a payload was taken at, before decoding it
+  static uint32_t tick(std::span<const byte> payload) {
+    BitReader r(payload);
+    r.read(32);
+    return r.read(32);
+  }
+
+  // Forgets a body's states, e.g. once the server has stopped sending it.
+  void forget(int32_t id) {
+    m_kept.erase(id);
+  }
+
+  // what to acknowledge: the newest sequence and a bit for each of the 32
+  // before it
+  uint32_t latest() const {
+    return m_latest;
+  }
+
+  uint32_t received() const {
+    return m_received;
+  }
+
+  // whether anything arrived since the last call
+  bool take_pending() {
+    return std::exchange(m_pending, false);
+  }
+
+private:
+  struct Kept {
+    bool used = false;
+    uint32_t sequence;
+    uint32_t tick;
+    QuantizedBody state;
+  };
+
+  int32_t predict(int32_t p, int32_t v, uint32_t ticks) const {
+    return ::predict(p, v, ticks, m_quantization, m_rate);
+  }
+
+  const Kept *find(int32_t id, uint32_t sequence) const {
+    const auto it = m_kept.find(id);
+    if (it == m_kept.end()) {
+      return nullptr;
+    }
+    for (const Kept &k : it->second) {
+      if (k.used && k.sequence == sequence) {
+        return &k;
+      }
+    }
+    return nullptr;
+  }
+
+  // Keeps the newest SNAPSHOT_KEEP states by sequence, not by arrival, so
+  // anything the server can still refer to is here.
+  void keep(const QuantizedBody &b, uint32_t sequence, uint32_t tick) {
+    auto &kept = m_kept[b.id];
+    Kept *oldest = &kept[0];
+    for (Kept &k : kept) {
+      if (!k.used) {
+        oldest = &k;
+        break;
+      }
+      if (int32_t(k.sequence - oldest->sequence) < 0) {
+        oldest = &k;
+      }
+    }
+    if (!oldest->used || int32_t(sequence - oldest->sequence) > 0) {
+      *oldest = {true, sequence, tick, b};
+    }
+  }
+
+  // Forgets a body's states, unless a newer payload than the one dropping it
+  // has sent it again.
+  void drop(int32_t id, uint32_t sequence) {
+    const auto it = m_kept.find(id);
+    if (it == m_kept.end()) {
+      return;
+    }
+    for (const Kept &k : it->second) {
+      if (k.used && int32_t(k.sequence - sequence) > 0) {
+        return;
+      }
+    }
+    m_kept.erase(it);
+  }
+
+  void received(uint32_t sequence) {
+    m_pending = true;
+    if (!m_any) {
+      m_any = true;
+      m_latest = sequence;
+      return;
+    }
+    const int32_t ahead = int32_t(sequence - m_latest);
+    if (ahead > 0) {
+      m_received = ahead >= 32 ? 0 : m_received << ahead;
+      if (ahead <= 32) {
+        m_received |= 1u << (ahead - 1);
+      }
+      m_latest = sequence;
+    } else if (ahead < 0 && ahead >= -32) {
+      m_received |= 1u << (-ahead - 1);
+    }
+  }
+
+  Quantization m_quantization;
+  uint32_t m_rate;
+  std::unordered_map<int32_t, std::array<Kept, SNAPSHOT_KEEP>> m_kept;
+  std::vector<QuantizedBody> m_decoded;
+  std::vector<int32_t> m_leaves;
+
+  bool m_any = false;
+  bool m_pending = false;
+  uint32_t m_latest = 0;
+  uint32_t m_received = 0;
+};
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Incremental sweep and prune. Box endpoints are kept sorted along x (and y)
+// across frames and re-sorted with an insertion sort, which is close to
+// linear when bodies barely move. Every swap of a min past a max endpoint is
+// a pair starting or stopping to overlap, so the overlapping pair set is
+// maintained by the sort itself.
+class SweepAndPrune {
+public:
+  // when false, only sort along x; pairs overlap on x alone
+  bool both_axes = true;
+  // boxes are grown by this much on every side
+  float margin = 0;
+
+  template <typename T> void update(std::span<T> bodies) {
+    if (bodies.size() != m_lo.size() || both_axes != m_both_axes) {
+      rebuild(bodies);
+      return;
+    }
+
+    bounds(bodies);
+    m_swaps = 0;
+    for (int axis = 0; axis < (m_both_axes ? 2 : 1); axis++) {
+      for (Endpoint &e : m_axis[axis]) {
+        e.value = along(e.max ? m_hi[e.body] : m_lo[e.body], axis);
+      }
+      sort(axis);
+    }
+  }
+
+  void invalidate() {
+    m_lo.clear();
+  }
+
+  // pairs whose boxes overlap, lower index first
+  std::span<const std::pair<uint32_t, uint32_t>> pairs() const {
+    return m_pairs;
+  }
+
+  template <typename T, typename F>
+  void for_each(std::span<T> bodies, F &&f) const {
+    for (const auto &[a, b] : m_pairs) {
+      f(bodies[a], bodies[b]);
+    }
+  }
+
+  // endpoint swaps in the last update, the incremental part of the cost;
+  // none after a rebuild, which sorts from scratch
+  uint64_t swaps() const {
+    return m_swaps;
+  }
+
+private:
+  struct Endpoint {
+    float value;
+    uint32_t body : 31;
+    uint32_t max : 1;
+  };
+
+  // at equal values a min sorts first, so touching boxes overlap
+  static bool less(const Endpoint &a, const Endpoint &b) {
+    return a.value < b.value || (a.value == b.value && !a.max && b.max);
+  }
+
+  static float along(sf::Vector2f v, int axis) {
+    return axis == 0 ? v.x : v.y;
+  }
+
+  template <typename T> void bounds(std::span<T> bodies) {
+    m_lo.resize(bodies.size());
+    m_hi.resize(bodies.size());
+    for (std::size_t i = 0; i < bodies.size(); i++) {
+      const sf::Vector2f c = bodies[i].center();
+      const float r = bodies[i].radius() + margin;
+      m_lo[i] = {c.x - r, c.y - r};
+      m_hi[i] = {c.x + r, c.y + r};
+    }
+  }
+
+  bool overlaps(uint32_t a, uint32_t b) const {
+    const bool x = m_lo[a].x <= m_hi[b].x && m_lo[b].x <= m_hi[a].x;
+    const bool y = m_lo[a].y <= m_hi[b].y && m_lo[b].y <= m_hi[a].y;
+    return x && (y || !m_both_axes);
+  }
+
+  template <typename T> void rebuild(std::span<T> bodies) {
+    m_both_axes = both_axes;
+    m_swaps = 0;
+    bounds(bodies);
+
+    m_pairs.clear();
+    m_slot.clear();
+    for (int axis = 0; axis < 2; axis++) {
+      m_axis[axis].clear();
+      for (uint32_t i = 0; i < bodies.size(); i++) {
+        m_axis[axis].push_back({along(m_lo[i], axis), i, 0});
+        m_axis[axis].push_back({along(m_hi[i], axis), i, 1});
+      }
+      std::sort(m_axis[axis].begin(), m_axis[axis].end(), less);
+    }
+
+    // one full sweep along x for the initial pair set
+    std::vector<uint32_t> active;
+    for (const Endpoint &e : m_axis[0]) {
+      if (e.max) {
+        std::erase(active, e.body);
+        continue;
+      }
+      for (uint32_t o : active) {
+        if (overlaps(e.body, o)) {
+          add(e.body, o);
+        }
+      }
+      active.push_back(e.body);
+    }
+  }
+
+  void sort(int axis) {
+    std::vector<Endpoint> &v = m_axis[axis];
+    for (std::size_t i = 1; i < v.size(); i++) {
+      const Endpoint e = v[i];
+      std::size_t j = i;
+      for (; j > 0 && less(e, v[j - 1]); j--) {
+        const Endpoint &passed = v[j - 1];
+        if (!e.max && passed.max) {
+          // e's box now starts before the other one ends
+          if (overlaps(e.body, passed.body)) {
+            add(e.body, passed.body);
+          }
+        } else if (e.max && !passed.max) {
+          // e's box now ends before the other one starts
+          remove(e.body, passed.body);
+        }
+        v[j] = passed;
+        m_swaps++;
+      }
+      v[j] = e;
+    }
+  }
+
+  static uint64_t key(uint32_t a, uint32_t b) {
+    return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+  }
+
+  void add(uint32_t a, uint32_t b) {
+    if (m_slot.try_emplace(key(a, b), m_pairs.size()).second) {
+      m_pairs.emplace_back(std::min(a, b), std::max(a, b));
+    }
+  }
+
+  void remove(uint32_t a, uint32_t b) {
+    const auto it = m_slot.find(key(a, b));
+    if (it == m_slot.end()) {
+      return;
+    }
+
+    const uint32_t slot = it->second;
+    m_slot.erase(it);
+    if (slot != m_pairs.size() - 1) {
+      m_pairs[slot] = m_pairs.back();
+      m_slot[key(m_pairs[slot].first, m_pairs[slot].second)] = slot;
+    }
+    m_pairs.pop_back();
+  }
+
+  bool m_both_axes = true;
+  std::vector<Endpoint> m_axis[2];
+  std::vector<sf::Vector2f> m_lo;
+  std::vector<sf::Vector2f> m_hi;
+
+  std::vector<std::pair<uint32_t, uint32_t>> m_pairs;
+  std::unordered_map<uint64_t, uint32_t> m_slot; // pair key -> m_pairs index
+  uint64_t m_swaps = 0;
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <vector>
+
+// Barnes-Hut quadtree for gravity. Every node keeps the total mass and the
+// centre of mass of the bodies under it, so a far away node can stand in for
+// all of them. theta is how small a node has to look from a body before it's
+// used whole: 0 opens everything (exact), bigger is cheaper and rougher.
+class GravityTree {
+public:
+  static constexpr uint32_t LEAF_SIZE = 8;
+  static constexpr int MAX_DEPTH = 24;
+  static constexpr uint32_t NONE = ~0u;
+
+  template <typename T> void build(std::span<const T> bodies) {
+    const uint32_t n = uint32_t(bodies.size());
+    m_position.resize(n);
+    m_mass.resize(n);
+    m_index.resize(n);
+    std::iota(m_index.begin(), m_index.end(), 0);
+    m_nodes.clear();
+
+    sf::Vector2f lo = {
+        std::numeric_limits<float>::max(), std::numeric_limits<float>::max()
+    };
+    sf::Vector2f hi = -lo;
+    for (uint32_t i = 0; i < n; i++) {
+      m_position[i] = bodies[i].center();
+      m_mass[i] = bodies[i].mass();
+      lo = {std::min(lo.x, m_position[i].x), std::min(lo.y, m_position[i].y)};
+      hi = {std::max(hi.x, m_position[i].x), std::max(hi.y, m_position[i].y)};
+    }
+    if (n == 0) {
+      return;
+    }
+
+    const float half = std::max(std::max(hi.x - lo.x, hi.y - lo.y) / 2, 1.0f);
+    split(0, n, (lo + hi) / 2.0f, half, 0);
+  }
+
+  // Calls f(mass, position) for every body or node that pulls on body i and
+  // returns how many there were.
+  template <typename F>
+  uint32_t for_each_source(std::size_t i, float theta, F &&f) const {
+    if (m_nodes.empty()) {
+      return 0;
+    }
+
+    const sf::Vector2f p = m_position[i];
+    uint32_t count = 0;
+    uint32_t stack[4 * MAX_DEPTH + 4];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+      const Node &node = m_nodes[stack[--top]];
+
+      if (node.leaf) {
+        for (uint32_t k = node.begin; k < node.end; k++) {
+          const uint32_t j = m_index[k];
+          if (j != i) {
+            f(m_mass[j], m_position[j]);
+            count++;
+          }
+        }
+        continue;
+      }
+
+      // far enough away and not around the body itself
+      const sf::Vector2f d = node.center_of_mass - p;
+      const float side = 2 * node.half;
+      const bool outside = std::abs(p.x - node.center.x) > node.half ||
+                           std::abs(p.y - node.center.y) > node.half;
+      if (outside && side * side < theta * theta * d.lengthSquared()) {
+        f(node.mass, node.center_of_mass);
+        count++;
+        continue;
+      }
+
+      for (uint32_t c : node.children) {
+        if (c != NONE) {
+          stack[top++] = c;
+        }
+      }
+    }
+    return count;
+  }
+
+  std::size_t nodes() const {
+    return m_nodes.size();
+  }
+
+private:
+  struct Node {
+    sf::Vector2f center; // of the square
+    float half;
+    sf::Vector2f center_of_mass;
+    float mass = 0;
+    uint32_t begin, end; // range of m_index
+    bool leaf = false;
+    uint32_t children[4] = {NONE, NONE, NONE, NONE};
+  };
+
+  // Builds the node for m_index[begin, end) and returns its index.
+  uint32_t split(
+      uint32_t begin, uint32_t end, sf::Vector2f center, float half, int depth
+  ) {
+    const uint32_t index = uint32_t(m_nodes.size());
+    m_nodes.push_back({center, half, {0, 0}, 0, begin, end});
+
+    sf::Vector2f moment = {0, 0};
+    float mass = 0;
+
+    if (end - begin <= LEAF_SIZE || depth == MAX_DEPTH) {
+      for (uint32_t k = begin; k < end; k++) {
+        moment += m_mass[m_index[k]] * m_position[m_index[k]];
+        mass += m_mass[m_index[k]];
+      }
+      m_nodes[index].leaf = true;
+    } else {
+      // bodies left/right of centre, then each half top/bottom
+      auto first = m_index.begin();
+      auto left = [&](uint32_t j) {
+        return m_position[j].x < center.x;
+      };
+      auto top = [&](uint32_t j) {
+        return m_position[j].y < center.y;
+      };
+      auto split_at = [&](uint32_t from, uint32_t to, auto side) {
+        return uint32_t(std::partition(first + from, first + to, side) - first);
+      };
+      const uint32_t mid = split_at(begin, end, left);
+      const uint32_t bounds[5] = {
+          begin, split_at(begin, mid, top), mid, split_at(mid, end, top), end
+      };
+
+      const float q = half / 2;
+      const sf::Vector2f offsets[4] = {{-q, -q}, {-q, q}, {q, -q}, {q, q}};
+      for (int c = 0; c < 4; c++) {
+        if (bounds[c] == bounds[c + 1]) {
+          continue;
+        }
+        const uint32_t child =
+            split(bounds[c], bounds[c + 1], center + offsets[c], q, depth + 1);
+        m_nodes[index].children[c] = child;
+        moment += m_nodes[child].mass * m_nodes[child].center_of_mass;
+        mass += m_nodes[child].mass;
+      }
+    }
+
+    m_nodes[index].mass = mass;
+    m_nodes[index].center_of_mass = mass != 0 ? moment / mass : center;
+    return index;
+  }
+
+  std::vector<Node> m_nodes;
+  std::vector<uint32_t> m_index;
+  std::vector<sf::Vector2f> m_position;
+  std::vector<float> m_mass;
+};